@@ -0,0 +1,68 @@
+/* Decryption cost of security mode 5 telegrams: MbusAes::decrypt_cbc() in
+ * place, as the state machine decrypts the encrypted blocks of a telegram
+ * while it is received, built as on the ESP32 (mbedtls, here the software
+ * implementation of the host). ns per byte and MB per second for payloads
+ * of one block up to the longest a telegram carries, and the cost of
+ * setting the key.
+ *
+ *   bench_aes [iterations]
+ *
+ * Returns non-zero if the NIST SP 800-38A vector does not decrypt.
+ * */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+
+#include "mbus_aes.h"
+
+using namespace esphome::mbus;
+
+//NIST SP 800-38A, F.2.2 CBC-AES128.Decrypt, first block
+static const uint8_t nist_key[16] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+                                     0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+static const uint8_t nist_iv[16] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+                                    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+static const uint8_t nist_ciphertext[16] = {0x76, 0x49, 0xab, 0xac, 0x81, 0x19, 0xb2, 0x46,
+                                            0xce, 0xe9, 0x8e, 0x9b, 0x12, 0xe9, 0x19, 0x7d};
+static const uint8_t nist_plaintext[16] = {0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96,
+                                           0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a};
+
+int main(int argc, char **argv) {
+  uint32_t iterations = argc > 1 ? atoi(argv[1]) : 200000;
+
+  MbusAes aes;
+  uint8_t iv[16];
+  uint8_t data[240];
+  if (!aes.set_key(nist_key)) {
+    printf("no AES implementation\n");
+    return 1;
+  }
+  memcpy(iv, nist_iv, sizeof(iv));
+  memcpy(data, nist_ciphertext, sizeof(nist_ciphertext));
+  if (!aes.decrypt_cbc(iv, data, sizeof(nist_ciphertext)) || memcmp(data, nist_plaintext, sizeof(nist_plaintext))) {
+    printf("NIST vector does not decrypt\n");
+    return 1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; i++) aes.set_key(nist_key);
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  printf("set_key: %.1f ns\n", ns / iterations);
+
+  //one block, a short and a long telegram, the longest payload of a long frame
+  printf("%7s %9s %9s %9s\n", "bytes", "ns/tg", "ns/byte", "MB/s");
+  memset(data, 0x5A, sizeof(data));
+  for (uint16_t len : {(uint16_t) 16, (uint16_t) 64, (uint16_t) 128, (uint16_t) sizeof(data)}) {
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; i++) {
+      memcpy(iv, nist_iv, sizeof(iv));
+      aes.decrypt_cbc(iv, data, len);
+    }
+    ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    printf("%7d %9.1f %9.2f %9.1f\n", len, ns / iterations, ns / iterations / len,
+           (double) len * iterations / (ns / 1e9) / 1e6);
+  }
+  return 0;
+}
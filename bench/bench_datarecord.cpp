@@ -0,0 +1,133 @@
+/* Decoding cost of the Data Records of a telegram, per frame of the corpus:
+ * ns per record, records per second, and heap allocations per telegram,
+ * with the key table a typical configuration of sensors generates.
+ *
+ *   bench_datarecord [iterations]
+ *
+ * Each frame is decoded whole, and as the state machine decodes it while
+ * it is being received: called again for every byte that arrives.
+ * Returns non-zero if a frame of the corpus does not decode, or any
+ * decoding allocates.
+ * */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "corpus.h"
+#include "mbus_datarecord.h"
+
+using namespace esphome::mbus;
+
+static std::atomic<uint64_t> allocations{0};
+
+void *operator new(size_t size) {
+  allocations++;
+  void *p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+struct Frame {
+  const char *name;
+  std::vector<uint8_t> data;
+  std::vector<MbusRecordKey> keys;
+  std::vector<MbusRecordSlot> slots;
+};
+
+static MbusRecordKey key(uint64_t vif_vife, uint64_t storage = 0, uint32_t tariff = 0, uint16_t subunit = 0) {
+  return {vif_vife, storage, MbusPackRecordAttributes(tariff, subunit, MBUS_INSTANT_VALUE)};
+}
+
+//the sensors a configuration would have for each meter
+static std::vector<MbusRecordKey> keys_for(const std::string &name) {
+  if (name == "water") return {key(0x13), key(0x04, 0, 2, 1)};
+  if (name == "heat") return {key(0x06), key(0x13), key(0x3B), key(0x2D), key(0x59), key(0x5D), key(0x06, 1)};
+  return {key(0x03), key(0x03, 0, 1), key(0x03, 0, 2), key(0x2B), key(0xFD48, 0, 0, 1), key(0xFD48, 0, 0, 2),
+          key(0xFD48, 0, 0, 3), key(0xFD59, 0, 0, 1), key(0xFD59, 0, 0, 2), key(0xFD59, 0, 0, 3)};
+}
+
+static std::vector<uint8_t> parse_frame(const char *hex) {
+  std::vector<uint8_t> data;
+  for (const char *p = hex; *p;) {
+    if (*p == ' ') {
+      p++;
+      continue;
+    }
+    data.push_back((uint8_t) strtoul(std::string(p, 2).c_str(), nullptr, 16));
+    p += 2;
+  }
+  return data;
+}
+
+/* decode the variable payload of frame, in steps of step bytes as they arrive
+ * (0: all at once), returns the number of records, 0 on error
+ * */
+static uint8_t decode(Frame *frame, uint16_t step) {
+  const uint8_t *tg = frame->data.data();
+  uint16_t end = tg[1] + 3;
+  uint16_t pos = 19;
+  uint8_t records = 0;
+  for (auto &slot : frame->slots) slot.pending_count = 0;
+  enum MbusPayloadStatus status = MBUS_PAYLOAD_INCOMPLETE;
+  for (uint16_t avail = step ? 20 : frame->data.size(); status == MBUS_PAYLOAD_INCOMPLETE; avail += step) {
+    if (avail > frame->data.size()) avail = frame->data.size();
+    status = MbusParseVariablePayload(tg, &pos, avail, end, frame->keys.data(), frame->slots.data(), frame->keys.size(),
+                                      &records, "bench");
+    if (avail == frame->data.size()) break;
+  }
+  return (status == MBUS_PAYLOAD_DONE) ? records : 0;
+}
+
+int main(int argc, char **argv) {
+  uint32_t iterations = argc > 1 ? atoi(argv[1]) : 200000;
+  int failed = 0;
+
+  std::vector<Frame> frames;
+  for (const auto &entry : bench_corpus) {
+    Frame frame{entry.name, parse_frame(entry.hex), keys_for(entry.name), {}};
+    std::sort(frame.keys.begin(), frame.keys.end());
+    frame.slots.resize(frame.keys.size());
+    frames.push_back(frame);
+  }
+
+  printf("%-12s %-9s %7s %7s %9s %12s %12s\n", "frame", "decoding", "bytes", "records", "ns/record", "records/s",
+         "allocs/tg");
+  for (auto &frame : frames) {
+    const std::vector<uint8_t> &tg = frame.data;
+    uint8_t checksum = 0;
+    for (uint16_t i = 4; i < tg.size() - 2; i++) checksum += tg[i];
+    if (tg.size() != tg[1] + 6u || tg[tg.size() - 2] != checksum) {
+      printf("%-12s is not a valid long frame\n", frame.name);
+      failed++;
+      continue;
+    }
+    uint8_t records = decode(&frame, 0);
+    uint16_t matched = 0;
+    for (auto &slot : frame.slots) matched += (slot.pending_count == 1);
+    if (!records || matched != frame.keys.size()) {
+      printf("%-12s does not decode: %d records, %d of %d keys found\n", frame.name, records, matched,
+             (int) frame.keys.size());
+      failed++;
+      continue;
+    }
+    for (uint16_t step : {(uint16_t) 0, (uint16_t) 1}) {
+      uint64_t allocated = allocations.load();
+      auto start = std::chrono::steady_clock::now();
+      uint64_t total = 0;
+      for (uint32_t i = 0; i < iterations; i++) total += decode(&frame, step);
+      double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+      double allocs = (double) (allocations.load() - allocated) / iterations;
+      printf("%-12s %-9s %7d %7d %9.1f %12.0f %12.2f\n", frame.name, step ? "per byte" : "whole",
+             (int) frame.data.size(), records, ns / total, total / (ns / 1e9), allocs);
+      if (allocs > 0) failed++;
+    }
+  }
+  return failed ? 1 : 0;
+}
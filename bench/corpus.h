@@ -0,0 +1,28 @@
+#pragma once
+
+/* RSP_UD long frames to decode, as received from the bus.
+ *
+ * water: the example response of EN 13757-3 (water meter, 3 records)
+ * heat: laid out like a Kamstrup Multical 602 readout, energy, volume,
+ *   flow, power, temperatures, date and storage 1 (13 records)
+ * electricity: laid out like a three-phase ABB A43 readout, BCD energy
+ *   per tariff, power, voltage and current per phase in subunits 1-3
+ *   (15 records)
+ * */
+struct BenchFrame {
+  const char *name;
+  const char *hex;
+};
+
+static const BenchFrame bench_corpus[] = {
+    {"water", "68 1F 1F 68 08 02 72 78 56 34 12 24 40 01 07 55 00 00 00 03 13 15 31 00 DA 02 3B 13 01 8B 60 04 37 18 02 "
+              "18 16"},
+    {"heat", "68 53 53 68 08 01 72 43 86 71 67 2D 2C 34 04 1A 00 00 00 04 06 3A 5E 00 00 04 13 A3 C8 0B 00 04 22 E4 A1 "
+             "00 00 04 3B 4A 01 00 00 04 2D 1B 00 00 00 02 59 DC 1A 02 5D 4E 10 02 61 8E 0A 04 6D 2B 0F B7 2C 44 06 10 "
+             "57 00 00 44 13 60 A7 0B 00 42 6C 9F 2C 01 FD 17 00 B6 16"},
+    {"electricity", "68 83 83 68 08 05 72 90 78 56 34 42 04 02 02 7C 00 00 00 0E 03 50 34 12 09 00 00 8E 10 03 20 11 "
+                    "02 05 00 00 8E 20 03 30 23 10 04 00 00 04 2B E8 03 00 00 84 40 2B 4D 01 00 00 84 80 40 2B 3E 01 "
+                    "00 00 84 C0 40 2B 5D 01 00 00 84 40 FD 48 FC 08 00 00 84 80 40 FD 48 F1 08 00 00 84 C0 40 FD 48 "
+                    "02 09 00 00 84 40 FD 59 A0 0F 00 00 84 80 40 FD 59 5C 12 00 00 84 C0 40 FD 59 CB 10 00 00 02 FF "
+                    "52 32 00 01 FD 17 00 0D 16"},
+};
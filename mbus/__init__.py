@@ -1,8 +1,21 @@
+import logging
+
 import esphome.codegen as cg
 from esphome.components import uart
 import esphome.config_validation as cv
 
-from esphome.const import CONF_ID
+from esphome.components.logger import LOG_LEVELS
+from esphome.const import (
+    CONF_ID,
+    CONF_LOG_LEVEL,
+    CONF_PRIORITY,
+    CONF_UPDATE_INTERVAL,
+    PLATFORM_ESP32,
+    PLATFORM_ESP8266,
+)
+from esphome.core import CORE
+
+_LOGGER = logging.getLogger(__name__)
 
 DEPENDENCIES = ["uart"]
 
@@ -11,16 +24,99 @@ Mbus = mbus_ns.class_("Mbus", cg.PollingComponent, uart.UARTDevice)
 MULTI_CONF = True
 
 CONF_SECONDARY_ADDRESS = "secondary_address"
+CONF_PRIMARY_ADDRESS = "primary_address"
+CONF_SCAN_BUS = "scan_bus"
+CONF_SCAN_CACHE_SIZE = "scan_cache_size"
+CONF_MAX_BAUD_RATE = "max_baud_rate"
+CONF_HISTORY_SIZE = "history_size"
+CONF_HEARTBEAT = "heartbeat"
+CONF_SELECTIVE_READOUT = "selective_readout"
+CONF_AES_KEY = "aes_key"
+CONF_TRACE_INTERVAL = "trace_interval"
+CONF_TRACE_HEXDUMP = "trace_hexdump"
+CONF_UPDATE_OFFSET = "update_offset"
+CONF_MAX_BUS_UTILIZATION = "max_bus_utilization"
+CONF_RX_TASK = "rx_task"
+
+# meters per preference of a cached scan result, and flash words of the ESP8266 the header and
+# each page take (the size of MbusScanCache and MbusScanCachePage in words, plus one)
+SCAN_CACHE_PAGE_METERS = 16
+SCAN_CACHE_HEADER_WORDS = 6
+SCAN_CACHE_PAGE_WORDS = 21
+ESP8266_FLASH_PREFERENCE_WORDS = 128
+
+# EN 13757-3 baud rate switch, CI 0xB8 (300 baud) to 0xBF (38400 baud)
+MBUS_BAUD_RATES = [300, 600, 1200, 2400, 4800, 9600, 19200, 38400]
+
+
+def validate_scan_bus(config):
+    if config[CONF_SCAN_BUS] and CONF_PRIMARY_ADDRESS in config:
+        raise cv.Invalid(f"{CONF_SCAN_BUS} requires secondary addressing, remove {CONF_PRIMARY_ADDRESS}")
+    if CONF_SCAN_CACHE_SIZE in config and not config[CONF_SCAN_BUS]:
+        raise cv.Invalid(f"{CONF_SCAN_CACHE_SIZE} requires {CONF_SCAN_BUS}")
+    if config[CONF_SCAN_BUS] and CORE.is_esp8266:
+        # the flash preferences of the ESP8266 are shared by all components
+        pages = -(-config.setdefault(CONF_SCAN_CACHE_SIZE, SCAN_CACHE_PAGE_METERS) // SCAN_CACHE_PAGE_METERS)
+        words = SCAN_CACHE_HEADER_WORDS + pages * SCAN_CACHE_PAGE_WORDS
+        if words > ESP8266_FLASH_PREFERENCE_WORDS // 2:
+            _LOGGER.warning(
+                "%s of %d meters takes %d of the %d words of flash preferences of the ESP8266, "
+                "other components may find no room left",
+                CONF_SCAN_CACHE_SIZE,
+                config[CONF_SCAN_CACHE_SIZE],
+                words,
+                ESP8266_FLASH_PREFERENCE_WORDS,
+            )
+    return config
+
+
+def validate_update_offset(config):
+    if CONF_UPDATE_OFFSET in config and config[CONF_UPDATE_OFFSET] >= config[CONF_UPDATE_INTERVAL]:
+        raise cv.Invalid(f"{CONF_UPDATE_OFFSET} must be less than {CONF_UPDATE_INTERVAL}")
+    return config
+
+
+def validate_trace(config):
+    if config[CONF_TRACE_HEXDUMP] and not (CONF_TRACE_INTERVAL in config and config[CONF_HISTORY_SIZE]):
+        raise cv.Invalid(f"{CONF_TRACE_HEXDUMP} requires {CONF_TRACE_INTERVAL} and {CONF_HISTORY_SIZE}")
+    return config
+
 
 CONFIG_SCHEMA = (
     cv.Schema(
         {
             cv.GenerateID(): cv.declare_id(Mbus),
-            cv.Optional(CONF_SECONDARY_ADDRESS, default=0xffffffffffffffff): cv.int_range(0x0000000000000000, 0xffffffffffffffff),
+            cv.Exclusive(CONF_SECONDARY_ADDRESS, "address"): cv.int_range(0x0000000000000000, 0xffffffffffffffff),
+            cv.Exclusive(CONF_PRIMARY_ADDRESS, "address"): cv.int_range(0, 250),
+            cv.Optional(CONF_SCAN_BUS, default=False): cv.boolean,
+            # meters, 16 on the ESP8266 and all that are scanned elsewhere by default
+            cv.Optional(CONF_SCAN_CACHE_SIZE): cv.int_range(1, 64),
+            cv.Optional(CONF_MAX_BAUD_RATE): cv.one_of(*MBUS_BAUD_RATES, int=True),
+            # bytes, each frame takes its length + 6
+            cv.Optional(CONF_HISTORY_SIZE, default=0): cv.int_range(0, 65535),
+            cv.Optional(CONF_HEARTBEAT): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_SELECTIVE_READOUT, default=False): cv.boolean,
+            cv.Optional(CONF_PRIORITY, default=0): cv.int_range(-128, 127),
+            cv.Optional(CONF_UPDATE_OFFSET): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_MAX_BUS_UTILIZATION): cv.All(
+                cv.percentage, cv.Range(min=0.0, min_included=False)
+            ),
+            # compile-time, for all instances
+            cv.Optional(CONF_LOG_LEVEL): cv.one_of(*LOG_LEVELS, upper=True),
+            cv.Optional(CONF_TRACE_INTERVAL): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_TRACE_HEXDUMP, default=False): cv.boolean,
+            # compile-time, for all instances
+            cv.Optional(CONF_RX_TASK): cv.All(cv.only_on_esp32, cv.boolean),
+            cv.Optional(CONF_AES_KEY): cv.All(
+                cv.only_on([PLATFORM_ESP32, PLATFORM_ESP8266]), cv.bind_key
+            ),
         }
     )
     .extend(cv.polling_component_schema("60s"))
     .extend(uart.UART_DEVICE_SCHEMA)
+    .add_extra(validate_scan_bus)
+    .add_extra(validate_trace)
+    .add_extra(validate_update_offset)
 )
 
 async def to_code(config):
@@ -29,5 +125,38 @@ async def to_code(config):
 
     await uart.register_uart_device(var, config)
 
-    cg.add(var.set_secondary_address(config[CONF_SECONDARY_ADDRESS]))
+    if CONF_SECONDARY_ADDRESS in config:
+        cg.add(var.set_secondary_address(config[CONF_SECONDARY_ADDRESS]))
+    if CONF_PRIMARY_ADDRESS in config:
+        cg.add(var.set_primary_address(config[CONF_PRIMARY_ADDRESS]))
+    if config[CONF_SCAN_BUS]:
+        cg.add(var.set_scan_bus(config[CONF_ID].id))
+        if CONF_SCAN_CACHE_SIZE in config:
+            cg.add(var.set_scan_cache_size(config[CONF_SCAN_CACHE_SIZE]))
+    if CONF_HEARTBEAT in config:
+        cg.add(var.set_heartbeat(config[CONF_HEARTBEAT]))
+    if config[CONF_HISTORY_SIZE]:
+        cg.add(var.set_history_size(config[CONF_HISTORY_SIZE]))
+    if CONF_MAX_BAUD_RATE in config:
+        cg.add(var.set_max_baud_rate(config[CONF_MAX_BAUD_RATE]))
+    # the most verbose level any instance asks for
+    levels = [conf[CONF_LOG_LEVEL] for conf in CORE.config["mbus"] if CONF_LOG_LEVEL in conf]
+    if levels:
+        level = max(levels, key=list(LOG_LEVELS).index)
+        cg.add_define("MBUS_LOG_LEVEL", LOG_LEVELS[level])
+    if any(conf.get(CONF_RX_TASK, False) for conf in CORE.config["mbus"]):
+        cg.add_define("MBUS_RX_TASK")
+    if config[CONF_PRIORITY]:
+        cg.add(var.set_priority(config[CONF_PRIORITY]))
+    if CONF_UPDATE_OFFSET in config:
+        cg.add(var.set_update_offset(config[CONF_UPDATE_OFFSET]))
+    if CONF_MAX_BUS_UTILIZATION in config:
+        cg.add(var.set_max_bus_utilization(config[CONF_MAX_BUS_UTILIZATION] * 100.0))
+    if CONF_TRACE_INTERVAL in config:
+        cg.add(var.set_trace_interval(config[CONF_TRACE_INTERVAL]))
+        cg.add(var.set_trace_hexdump(config[CONF_TRACE_HEXDUMP]))
+    if CONF_AES_KEY in config:
+        cg.add(var.set_aes_key(config[CONF_AES_KEY]))
+    if config[CONF_SELECTIVE_READOUT]:
+        cg.add(var.set_selective_readout(True))
     
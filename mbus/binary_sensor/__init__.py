@@ -0,0 +1,28 @@
+import esphome.codegen as cg
+from esphome.components import binary_sensor, mbus
+import esphome.config_validation as cv
+
+from esphome.const import (
+    DEVICE_CLASS_PROBLEM,
+    ENTITY_CATEGORY_DIAGNOSTIC,
+)
+
+DEPENDENCIES = ["mbus"]
+
+CONF_MBUS_ID = "mbus_id"
+
+# on while the meter does not respond and is only probed now and then
+CONFIG_SCHEMA = binary_sensor.binary_sensor_schema(
+    device_class=DEVICE_CLASS_PROBLEM,
+    entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+).extend(
+    {
+        cv.GenerateID(CONF_MBUS_ID): cv.use_id(mbus.Mbus),
+    }
+)
+
+
+async def to_code(config):
+    var = await binary_sensor.new_binary_sensor(config)
+    parent = await cg.get_variable(config[CONF_MBUS_ID])
+    cg.add(parent.set_suspended_binary_sensor(var))
@@ -1,7 +1,17 @@
 #include "mbus.h"
-#include "esphome/core/application.h"
-//#include "esphome/core/helpers.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
 #include "esphome/core/log.h"
+#include "mbus_log.h"
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#ifdef MBUS_RX_TASK
+#include "mbus_spsc.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
 
 namespace esphome {
 namespace mbus {
@@ -11,18 +21,165 @@ static const char *const TAG = "mbus";
 /* ESPHome code guide says "Use of static variables within component/platform
  *  classes is not permitted, as this is likely to cause problems when multiple
  *  instances of the component/platform are created".
- * Here, however, this is the explicit goal: to share mbus_uart_locked_ between
- * all instances, providing mutually exclusive access to the underlying UART.
+ * Here, however, this is the explicit goal: to share one MbusBus between
+ * all instances using the same UART, providing mutually exclusive access to it.
  * This is necessary as communication may take a long time (up to a second or more)
  * to be completed, so update() of another Mbus instance may be called before the
  * transaction finishes, causing the transaction to be clobbered.
+ * Instances on different UARTs (i.e. separate buses) get separate buses and
+ * run their transactions in parallel.
+ * 
+ * Of the meters waiting for the bus, it goes to the most urgent one (see
+ * Mbus::mbus_poll_before()), equally urgent ones take turns in the order
+ * they are configured. Back to back transactions form a sweep: only the
+ * first one resets the bus, the others select their meter right away (a
+ * select deselects every other meter).
  * */ 
-static bool mbus_uart_locked_;
+struct MbusBus {
+  uart::UARTComponent* uart;
+  Mbus* owner; //holding the bus, nullptr if free
+  Mbus* last; //previous owner, the others come first among equals
+  Mbus* meters; //chained by mbus_bus_next_, in configuration order
+  bool swept; //bus has been reset and in use since
+  uint32_t busy_since; //utilization: time held in the current window
+  uint32_t busy_ms;
+  uint32_t window_start;
+  float utilization; //percentage of the last complete window, NAN before
+  float max_utilization; //lowest max_bus_utilization of its meters
+  const struct MbusScanResult* scan_result; //of the instance scanning this uart, if any
+  struct MbusBus* next;
+#ifdef MBUS_RX_TASK
+  struct MbusRxTask* rx{nullptr}; //nullptr if the task could not be started
+#endif
+};
+static struct MbusBus* mbus_buses_ = nullptr;
+
+#ifdef MBUS_RX_TASK
+/* With rx_task, a FreeRTOS task per bus moves the bytes received by the uart
+ * into queue as they arrive, so a main loop held up by another component
+ * neither lets the RX buffer of the uart overrun nor delays the bytes of a
+ * long frame. The state machine still runs in the main loop, where sensors
+ * are published, and reads from queue only; from then on the uart is read
+ * by the task alone. The task notes when the bytes arrived, and the state
+ * machine learns latencies and waits for quiet from these times rather than
+ * from its own ticks, which a held up main loop would stretch.
+ * 
+ * The task only polls the uart while a meter holds the bus (active), and is
+ * blocked on its notification otherwise. Switching the baud rate reinstalls
+ * the uart driver, and purging drops a chunk the task may have read but not
+ * yet pushed: the task is paused meanwhile, it acknowledges the pause
+ * whenever it is not inside the uart.
+ * */
+struct MbusRxTask {
+  MbusSpscQueue<mbus_rx_queue_len_> queue;
+  TaskHandle_t task{nullptr};
+  uint32_t (*clock)(){millis}; //of the meters on the bus
+  std::atomic<bool> active{false}; //bus held by a meter
+  std::atomic<bool> pause{false}; //requested by the main loop
+  std::atomic<bool> paused{false}; //acknowledged by the task
+  std::atomic<uint32_t> overruns{0}; //bytes dropped with the queue full
+  std::atomic<uint32_t> first_at{0}; //arrival of the bytes pushed into the empty queue
+  std::atomic<uint32_t> last_at{0}; //arrival of the bytes pushed last
+};
+
+static void mbus_rx_task(void* arg) {
+	struct MbusBus* bus = (struct MbusBus*) arg;
+	struct MbusRxTask* rx = bus->rx;
+	uint8_t chunk[mbus_rx_chunk_len_];
+	for(;;){
+		rx->paused.store(false);
+		if( rx->pause.load() || !rx->active.load() ){
+			rx->paused.store(true);
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			continue;
+		}
+		//the uart component has no RX event to block on: waiting a tick for bytes while the bus is held,
+		//or until the main loop releases the bus or resumes the task
+		int n = bus->uart->available();
+		if(n <= 0){
+			rx->paused.store(true);
+			ulTaskNotifyTake(pdTRUE, 1);
+			continue;
+		}
+		if(n > mbus_rx_chunk_len_) n = mbus_rx_chunk_len_;
+		if(!bus->uart->read_array(chunk, n)) continue;
+		//times stored before the push, the main loop sees them with the bytes
+		uint32_t at = rx->clock();
+		if(!rx->queue.available()) rx->first_at.store(at);
+		rx->last_at.store(at);
+		uint16_t pushed = rx->queue.push(chunk, n);
+		if(pushed < n) rx->overruns.fetch_add(n - pushed);
+	}
+}
+
+/* main loop: wake the task when the bus is taken, let it block once it is released
+ * */
+static void mbus_rx_set_active(struct MbusRxTask* rx, bool active) {
+	rx->active.store(active);
+	if(active) xTaskNotifyGive(rx->task);
+}
+
+/* main loop: keep the task out of the uart until resumed
+ * */
+static void mbus_rx_pause(struct MbusRxTask* rx) {
+	rx->pause.store(true);
+	while(!rx->paused.load()) delay(1);
+}
+
+static void mbus_rx_resume(struct MbusRxTask* rx) {
+	rx->pause.store(false);
+	xTaskNotifyGive(rx->task);
+}
+#endif
+
+/* find the bus belonging to uart, creating it on first use (during setup)
+ * */
+static struct MbusBus* mbus_bus_for(uart::UARTComponent* uart, uint32_t (*clock)()) {
+	uint32_t now = clock();
+	struct MbusBus* bus;
+	for(bus = mbus_buses_; bus; bus = bus->next){
+		if(bus->uart == uart) return bus;
+	}
+	bus = new MbusBus{uart, nullptr, nullptr, nullptr, false, 0, 0, now, NAN, 100.0f, nullptr, mbus_buses_};
+	mbus_buses_ = bus;
+#ifdef MBUS_RX_TASK
+	bus->rx = new MbusRxTask();
+	bus->rx->clock = clock;
+	if(xTaskCreate(mbus_rx_task, "mbus_rx", mbus_rx_task_stack_, bus, mbus_rx_task_priority_, &(bus->rx->task)) != pdPASS){
+		ESP_LOGE(TAG, "Could not start RX task, reading the uart from the main loop");
+		delete bus->rx;
+		bus->rx = nullptr;
+	}
+#endif
+	return bus;
+}
+
+/* check whether a (possibly wildcarded) secondary address matches a fully specified one:
+ * each of the 8 ID digits may be wildcarded by F, manufacturer, version and medium
+ * only as a whole
+ * */
+static bool mbus_address_matches(uint64_t pattern, uint64_t address) {
+	for(uint8_t shift=32; shift<64; shift+=4){
+		uint8_t digit = (pattern >> shift) & 0x0F;
+		if( (digit != 0x0F) && (digit != ( (address >> shift) & 0x0F )) ) return false;
+	}
+	if( ( ( (pattern >> 16) & 0xFFFF ) != 0xFFFF ) && ( ( (pattern ^ address) >> 16 ) & 0xFFFF ) ) return false;
+	if( ( ( (pattern >> 8) & 0xFF ) != 0xFF ) && ( ( (pattern ^ address) >> 8 ) & 0xFF ) ) return false;
+	if( ( (pattern & 0xFF) != 0xFF ) && ( (pattern ^ address) & 0xFF ) ) return false;
+	return true;
+}
+
+static bool mbus_address_has_wildcard(uint64_t address) {
+	for(uint8_t shift=32; shift<64; shift+=4){
+		if( ( (address >> shift) & 0x0F ) == 0x0F ) return true;
+	}
+	return ( ( (address >> 16) & 0xFFFF ) == 0xFFFF ) || ( ( (address >> 8) & 0xFF ) == 0xFF ) || ( (address & 0xFF) == 0xFF );
+}
 
 /* calculate checksum for "long-type" mbus frame
  * */
 uint8_t Mbus::mbus_checksum(const uint8_t* data) {
-	uint8_t len;
+	uint16_t len;
 	uint8_t ret;
 	if(data[0] != 0x68) return 0;	//not MBUS_FRAME_TYPE_LONG
 	len=data[1]+6;
@@ -37,197 +194,1562 @@ uint8_t Mbus::mbus_checksum(const uint8_t* data) {
 	return ret;
 }
 
+/* void Mbus::mbus_learn_latency(struct MbusLatency* latency, uint32_t sample):
+ * 
+ * Fold an observed latency (in ms, from sending a frame until the first
+ * byte of the answer was seen) into the meter's estimate.
+ * */
+void Mbus::mbus_learn_latency(struct MbusLatency* latency, uint32_t sample) {
+	if(!latency->samples){
+		latency->srtt8 = sample << 3;
+		latency->rttvar4 = sample << 1;
+	} else {
+		int32_t err = (int32_t) sample - (int32_t) ( latency->srtt8 >> 3 );
+		latency->srtt8 = (uint32_t) ( (int32_t) latency->srtt8 + err );
+		if(err < 0) err = -err;
+		latency->rttvar4 = (uint32_t) ( (int32_t) latency->rttvar4 + err - (int32_t) ( latency->rttvar4 >> 2 ) );
+	}
+	if(latency->samples < 255) latency->samples++;
+}
+
+/* uint32_t Mbus::mbus_learned_timeout(const struct MbusLatency* latency, uint32_t ceiling):
+ * 
+ * Time to wait for an answer: smoothed latency plus four mean deviations
+ * plus a margin for the state machine tick, kept between the floor and the
+ * given static worst case. Without an estimate, the worst case is used.
+ * */
+uint32_t Mbus::mbus_learned_timeout(const struct MbusLatency* latency, uint32_t ceiling) {
+	if(!latency->samples) return ceiling;
+	uint32_t timeout = ( latency->srtt8 >> 3 ) + latency->rttvar4 + mbus_timeout_margin_ms_;
+	if(timeout < this->mbus_timeout_floor_) timeout = this->mbus_timeout_floor_;
+	if(timeout > ceiling) timeout = ceiling;
+	return timeout;
+}
+
+/* format n bytes as hex, separated by spaces, into line (3 * n + 1 chars),
+ * last byte first if reverse
+ * */
+static void mbus_format_hex(char* line, const uint8_t* data, uint8_t n, bool reverse) {
+	static const char digits[] = "0123456789ABCDEF";
+	for(uint8_t i=0; i<n; i++){
+		uint8_t byte = data[reverse ? n - 1 - i : i];
+		line[3*i] = digits[byte >> 4];
+		line[3*i + 1] = digits[byte & 0x0F];
+		line[3*i + 2] = ' ';
+	}
+	line[3*n] = 0;
+}
+
+/* bool Mbus::mbus_parse_header():
+ * 
+ * Check the fixed data header of the frame being received, as soon as
+ * its first 19 bytes are in.
+ * 
+ * Returns false if the frame is unusable, true otherwise.
+ * */
+bool Mbus::mbus_parse_header() {
+  uint8_t* tg = this->telegram;
+  
+  //tg[0] to tg[2] checked by statemachine
+  //tg[3] start byte
+  
+  if(tg[4] != MBUS_CONTROL_RSP_UD){
+	  ESP_LOGE(TAG, " %s: Unexpected control field %d", this->mbus_address_str_, tg[4]);
+	  return false;
+  }
+  
+  //tg[5] primary address (usually 0 anyway)
+  
+  if(tg[6] != MBUS_CI_RESP_VARIABLE){
+	  ESP_LOGE(TAG, " %s: Unexpected control information field %d", this->mbus_address_str_, tg[6]);
+	  return false;
+  }
+  
+  //tg[7] to tg[14] secondary address
+  
+  //identification number most significant byte first, manufacturer, version and medium as sent
+  MBUS_LOGD(TAG, " %s: Secondary address received: %02X%02X%02X%02X%02X%02X%02X%02X", this->mbus_address_str_,
+    tg[10], tg[9], tg[8], tg[7], tg[11], tg[12], tg[13], tg[14]);
+  
+  //tg[15] access number
+  
+  if(tg[16] & MBUS_STATUS_APP_ERROR){
+	  ESP_LOGE(TAG, " %s: Application error", this->mbus_address_str_);
+	  return false;
+  }
+  if(tg[16] & MBUS_STATUS_TEMPORARY_ERROR){
+	   ESP_LOGW(TAG, " %s: Temporary error status bit set", this->mbus_address_str_);
+  }
+  if(tg[16] & MBUS_STATUS_PERMANENT_ERROR){
+	  ESP_LOGW(TAG, " %s: Permanent error status bit set. Consider replacing meter.", this->mbus_address_str_);
+  }
+  if(tg[16] & MBUS_STATUS_LOW_POWER){
+	  ESP_LOGW(TAG, " %s: Low power status bit set. Consider replacing meter.", this->mbus_address_str_);
+  }
+  
+  //tg[17] to tg[18] configuration field: security mode, number of encrypted blocks
+  this->mbus_encrypted_len_ = 0;
+  if(tg[17] || tg[18]){
+	  uint8_t mode = tg[18] & 0x1F;
+	  if(mode != mbus_security_mode_aes_cbc_){
+		  ESP_LOGE(TAG, " %s: Unsupported security mode %d", this->mbus_address_str_, mode);
+		  return false;
+	  }
+	  if(!this->mbus_aes_.has_key()){
+		  ESP_LOGE(TAG, " %s: Encrypted telegram, no aes_key configured", this->mbus_address_str_);
+		  return false;
+	  }
+	  this->mbus_encrypted_len_ = (tg[17] >> 4) * MBUS_AES_BLOCK_LEN;
+	  //encrypted blocks must end before the checksum
+	  if(19 + this->mbus_encrypted_len_ > tg[1] + 4){
+		  ESP_LOGE(TAG, " %s: Encrypted blocks exceed frame", this->mbus_address_str_);
+		  return false;
+	  }
+  }
+  
+  MBUS_LOGD(TAG, " %s: Parsing fixed header done", this->mbus_address_str_);
+  
+  return true;
+}
+
+/* bool Mbus::mbus_decrypt_frame():
+ * 
+ * Decrypt the encrypted blocks of the frame being received in place, once
+ * they are all in. The initialization vector is manufacturer, identification
+ * number, version and medium, followed by eight times the access number.
+ * 
+ * Returns false if the decrypted payload does not start with 0x2F 0x2F,
+ * most likely because of a wrong key.
+ * */
+bool Mbus::mbus_decrypt_frame() {
+  uint8_t* tg = this->telegram;
+  uint8_t iv[MBUS_AES_BLOCK_LEN];
+  iv[0] = tg[11];
+  iv[1] = tg[12];
+  memcpy(&iv[2], &tg[7], 4);
+  iv[6] = tg[13];
+  iv[7] = tg[14];
+  memset(&iv[8], tg[15], 8);
+  
+  if( !this->mbus_aes_.decrypt_cbc(iv, &tg[19], this->mbus_encrypted_len_) ||
+    (tg[19] != mbus_encryption_check_) || (tg[20] != mbus_encryption_check_) ){
+	  ESP_LOGE(TAG, " %s: Decryption failed, check aes_key", this->mbus_address_str_);
+	  return false;
+  }
+  this->mbus_encrypted_len_ = 0;
+  return true;
+}
+
+/* void Mbus::mbus_decode_frame():
+ * 
+ * Decode the frame being received as far as it has arrived: check the
+ * fixed data header once it is complete, then decode each variable-length
+ * Data Record as soon as its last byte is in. Values of records requested
+ * by sensors go to the pending fields of their result slots.
+ * */
+void Mbus::mbus_decode_frame() {
+  if(this->mbus_scanning_) return;
+  
+  if( (this->mbus_header_state_ == MBUS_HEADER_PENDING) && (this->telegram[1] < 15) ){
+	  ESP_LOGE(TAG, " %s: Frame too short", this->mbus_address_str_);
+	  this->mbus_header_state_ = MBUS_HEADER_INVALID;
+  }
+  
+  if( (this->mbus_header_state_ == MBUS_HEADER_PENDING) && (this->mbus_rx_pos_ >= 19) ){
+	  if(this->mbus_parse_header()){
+		  this->mbus_header_state_ = MBUS_HEADER_OK;
+		  this->mbus_decode_pos_ = 19;
+		  this->mbus_payload_status_ = MBUS_PAYLOAD_INCOMPLETE;
+	  } else {
+		  this->mbus_header_state_ = MBUS_HEADER_INVALID;
+	  }
+  }
+  
+  if( (this->mbus_header_state_ != MBUS_HEADER_OK) || (this->mbus_payload_status_ != MBUS_PAYLOAD_INCOMPLETE) ) return;
+  
+  //encrypted records are decoded once all encrypted blocks are in
+  if(this->mbus_encrypted_len_){
+	  if(this->mbus_rx_pos_ < 19 + this->mbus_encrypted_len_) return;
+	  if(!this->mbus_decrypt_frame()){
+		  this->mbus_header_state_ = MBUS_HEADER_INVALID;
+		  return;
+	  }
+  }
+  
+  //variable payload fields follow
+  this->mbus_payload_status_ = MbusParseVariablePayload(this->telegram, &(this->mbus_decode_pos_), this->mbus_rx_pos_,
+    this->telegram[1] + 3, this->record_keys_, this->record_slots_, this->record_count_,
+    &(this->mbus_frame_record_count_), this->mbus_address_str_);
+}
+
+/* bool Mbus::mbus_finish_frame():
+ * 
+ * Complete decoding of a frame whose checksum has been verified: log
+ * manufacturer-specific data and commit the pending Data Records. The
+ * first frame of a readout clears all slots, records of further frames
+ * are added to them.
+ * 
+ * Sets this->mbus_more_frames_ if the meter signals that more frames follow.
+ * 
+ * Returns false if the frame is unusable, true otherwise. If parsing of
+ * the variable payload was aborted, the records decoded up to that point
+ * are kept.
+ * */
+bool Mbus::mbus_finish_frame() {
+  uint8_t* tg = this->telegram;
+  uint16_t len = tg[1] + 6; //payload + (start + length + length + start + checksum + stop)
+  
+  this->mbus_more_frames_ = false;
+  
+  if(this->mbus_header_state_ != MBUS_HEADER_OK){
+	  for(uint16_t i=0; i<this->record_count_; i++) this->record_slots_[i].pending_count = 0;
+	  return false;
+  }
+  
+  uint16_t pos = 0;
+  if(this->mbus_payload_status_ == MBUS_PAYLOAD_DONE) {
+	  pos = this->mbus_decode_pos_;
+	  MBUS_LOGD(TAG, " %s: Parsing variable payload done, %d data records", this->mbus_address_str_, this->mbus_frame_record_count_);
+  }
+  else { ESP_LOGW(TAG, " %s: Variable payload parsing aborted", this->mbus_address_str_); }
+
+  //manufacturer-specific data
+  if(pos && (pos <= len-3) && (tg[pos] == MBUS_DIF_MANUFACTURER_SPECIFIC_MULTIFRAME)){
+	  MBUS_LOGD(TAG, " %s: More frames follow", this->mbus_address_str_);
+	  this->mbus_more_frames_ = true;
+  }
+  
+
+  if(pos && (pos <= len-3) && ( (tg[pos] == MBUS_DIF_MANUFACTURER_SPECIFIC)
+    || (tg[pos] == MBUS_DIF_MANUFACTURER_SPECIFIC_MULTIFRAME) ) ) {
+#if MBUS_LOG_DETAIL
+    //most significant byte first, in lines of mbus_hex_line_bytes_
+    char line[3 * mbus_hex_line_bytes_ + 1];
+    uint16_t end = len - 2;
+    MBUS_LOGD(TAG, " %s: Manufacturer-specific data, %d bytes:", this->mbus_address_str_, end - pos - 1);
+    while(end > pos + 1){
+      uint8_t n = ( end - pos - 1 < mbus_hex_line_bytes_ ) ? end - pos - 1 : mbus_hex_line_bytes_;
+      end -= n;
+      mbus_format_hex(line, &tg[end], n, true);
+      MBUS_LOGD(TAG, "   %s", line);
+    }
+#endif
+  }
+  
+  //tg[len-2] checksum (verified by statemachine)
+  //tg[len-1] stop byte
+  
+  //checksum ok, the frame's records become part of the readout
+  for(uint16_t i=0; i<this->record_count_; i++){
+	  struct MbusRecordSlot* slot = &(this->record_slots_[i]);
+	  if(!this->mbus_frame_count_) slot->match_count = 0;
+	  if(slot->pending_count){
+		  slot->value = slot->pending_value;
+		  slot->datatype = slot->pending_datatype;
+		  slot->has_value = slot->pending_has_value;
+		  slot->match_count += slot->pending_count;
+	  }
+	  slot->pending_count = 0;
+  }
+  
+  return true;
+}
+
+/* void Mbus::mbus_fingerprint_frame():
+ * 
+ * Compare the frame just received (checksum verified) with the frame of the
+ * same index of the previous readout, by a hash of its data records and
+ * manufacturer-specific data. Access number and status are left out: many
+ * meters count up the access number with every response. If the frame
+ * differs, the readout is passed on to sensors.
+ * */
+void Mbus::mbus_fingerprint_frame() {
+  uint8_t* tg = this->telegram;
+  uint8_t index = this->mbus_frame_count_;
+  
+  //FNV-1a
+  uint32_t hash = 2166136261UL;
+  for(uint16_t pos=19; pos < this->mbus_telegram_len_ - 2; pos++){
+	  hash ^= tg[pos];
+	  hash *= 16777619UL;
+  }
+  
+  if( (index < this->mbus_fingerprint_count_) && (this->mbus_fingerprints_[index] == hash) ){
+	  if(tg[15] == this->mbus_access_numbers_[index]){
+		  MBUS_LOGD(TAG, " %s: Frame %d repeats previous response, access number %d", this->mbus_address_str_, index + 1, tg[15]);
+	  } else {
+		  MBUS_LOGD(TAG, " %s: Frame %d unchanged", this->mbus_address_str_, index + 1);
+	  }
+  } else {
+	  this->mbus_readout_changed_ = true;
+  }
+  this->mbus_fingerprints_[index] = hash;
+  this->mbus_access_numbers_[index] = tg[15];
+}
+
+/* prepare "select secondary address" frame
+ * */
+void Mbus::mbus_build_select_frame(uint64_t address) {
+ for(size_t i=0; i<mbus_select_frame_len_;i++) this->mbus_select_frame_[i]=mbus_select_frame_raw_[i];
+ this->mbus_select_frame_[7] = (uint8_t) ( address >> (4*8) );
+ this->mbus_select_frame_[8] = (uint8_t) ( address >> (5*8) );
+ this->mbus_select_frame_[9] = (uint8_t) ( address >> (6*8) );
+ this->mbus_select_frame_[10] = (uint8_t) ( address >> (7*8) );
+ this->mbus_select_frame_[11] = (uint8_t) ( address >> (3*8) );
+ this->mbus_select_frame_[12] = (uint8_t) ( address >> (2*8) );
+ this->mbus_select_frame_[13] = (uint8_t) ( address >> (1*8) );
+ this->mbus_select_frame_[14] = (uint8_t) ( address >> (0*8) );
+ this->mbus_select_frame_[15] = mbus_checksum(mbus_select_frame_);
+}
+
+/* baudrate-dependent worst case timeouts, used as ceilings once the
+ * meter's latency has been learned
+ * */
+void Mbus::mbus_set_timeouts(uint32_t baud_rate) {
+	uint32_t tbit_us = 1000000 / baud_rate;
+	this->mbus_timeout_short_ = ( (330 + 11) * tbit_us ) / 1000;
+	this->mbus_timeout_short_ += 150;
+	this->mbus_timeout_long_ = ( (330 + 11 + (11*mbus_frame_max_len_)) * tbit_us ) / 1000;
+	this->mbus_timeout_long_ += 150;
+	this->mbus_timeout_floor_ = ( 11 * tbit_us ) / 1000 + mbus_timeout_floor_ms_;
+}
+
+/* switch the uart to baud_rate, once everything written has been sent
+ * */
+void Mbus::mbus_set_baud_rate(uint32_t baud_rate) {
+	this->flush();
+#ifdef MBUS_RX_TASK
+	struct MbusRxTask* rx = this->mbus_bus_->rx;
+	if(rx) mbus_rx_pause(rx);
+#endif
+	this->parent_->set_baud_rate(baud_rate);
+	this->parent_->load_settings(false);
+#ifdef MBUS_RX_TASK
+	if(rx) mbus_rx_resume(rx);
+#endif
+	this->mbus_set_timeouts(baud_rate);
+}
+
+/* received bytes as seen by the state machine: from the queue of the RX
+ * task of the bus if there is one, from the uart otherwise
+ * */
+uint16_t Mbus::mbus_rx_available() {
+#ifdef MBUS_RX_TASK
+	if(this->mbus_bus_->rx) return this->mbus_bus_->rx->queue.available();
+#endif
+	return this->available();
+}
+
+bool Mbus::mbus_rx_read(uint8_t* data, uint16_t len) {
+#ifdef MBUS_RX_TASK
+	struct MbusRxTask* rx = this->mbus_bus_->rx;
+	if(rx) return (rx->queue.available() >= len) && (rx->queue.pop(data, len) == len);
+#endif
+	return this->read_array(data, len);
+}
+
+void Mbus::mbus_rx_purge() {
+#ifdef MBUS_RX_TASK
+	//with the task paused, nothing it has already read can be pushed after the queue is cleared
+	struct MbusRxTask* rx = this->mbus_bus_->rx;
+	if(rx){
+		mbus_rx_pause(rx);
+		rx->queue.clear();
+	}
+#endif
+#ifdef MBUS_RX_TASK
+	//bytes still in the uart arrived just now
+	if(rx && this->available()) rx->last_at.store(this->mbus_clock_());
+#endif
+	while(this->available()) this->read_array( this->telegram, 1 ) ;
+#ifdef MBUS_RX_TASK
+	if(rx) mbus_rx_resume(rx);
+#endif
+}
+
+/* uint32_t Mbus::mbus_rx_first_at(uint32_t now), mbus_rx_last_at(uint32_t now):
+ * 
+ * When the bytes received arrived: with the RX task, the time it pushed the
+ * first of them into the empty queue, or pushed (or purge drained) the last;
+ * now without the task. Never later than now.
+ * */
+uint32_t Mbus::mbus_rx_first_at(uint32_t now) {
+#ifdef MBUS_RX_TASK
+	if(this->mbus_bus_->rx){
+		uint32_t at = this->mbus_bus_->rx->first_at.load();
+		return ( (int32_t) (now - at) >= 0 ) ? at : now;
+	}
+#endif
+	return now;
+}
+
+uint32_t Mbus::mbus_rx_last_at(uint32_t now) {
+#ifdef MBUS_RX_TASK
+	if(this->mbus_bus_->rx){
+		uint32_t at = this->mbus_bus_->rx->last_at.load();
+		return ( (int32_t) (now - at) >= 0 ) ? at : now;
+	}
+#endif
+	return now;
+}
+
+/* bool Mbus::mbus_baud_negotiate():
+ * 
+ * Whether the selected meter is to be switched to max_baud_rate before
+ * requesting data: not during bus scan, not again after the readout failed
+ * at the higher rate, and not any more if the meter repeatedly did not
+ * acknowledge the switch.
+ * */
+bool Mbus::mbus_baud_negotiate() {
+	return !this->mbus_scanning_ && !this->mbus_baud_switched_ && !this->mbus_baud_fallback_ &&
+		(this->mbus_max_baud_rate_ > this->mbus_base_baud_rate_) && (this->mbus_baud_failures_ < mbus_max_retries_);
+}
+
+/* send "switch baudrate" command (SND_UD, CI 0xB8 to 0xBF) to the meter
+ * addressed by the request frame, using the FCB the request frame holds
+ * */
+void Mbus::mbus_send_baud_switch(uint32_t baud_rate) {
+	uint8_t frame[mbus_baud_frame_len_];
+	uint8_t ci = mbus_ci_baud_300_;
+	for(uint32_t rate = mbus_baud_min_; rate < baud_rate; rate <<= 1) ci++;
+	for(size_t i=0; i<mbus_baud_frame_len_;i++) frame[i]=mbus_baud_frame_raw_[i];
+	frame[4] |= this->mbus_request_frame_[1] & mbus_control_fcb_;
+	frame[5] = this->mbus_request_frame_[2];
+	frame[6] = ci;
+	frame[7] = mbus_checksum(frame);
+	this->write_array(frame, mbus_baud_frame_len_);
+}
+
+/* encode a record key as DIF, DIFEs, VIF and VIFEs of a "select data records
+ * for readout" request, to out unless nullptr; returns the number of bytes
+ * */
+static uint8_t mbus_encode_record_selection(const struct MbusRecordKey* key, uint8_t* out) {
+	uint32_t tariff = key->attributes & 0xFFFFF;
+	uint16_t subunit = (key->attributes >> 20) & 0x3FF;
+	uint8_t function = (key->attributes >> 30) << 4;
+	uint64_t storage = key->storage;
+	uint8_t n = 0;
+	
+	//as many DIFEs as storage (above its lowest bit), tariff and subunit need
+	uint8_t difes = 0;
+	while( (difes < MBUS_DIFE_MAX) && ( (storage >> (4*difes + 1)) || (tariff >> (2*difes)) || (subunit >> difes) ) ) difes++;
+	
+	if(out) out[n] = mbus_dif_selection_ | function | ( (storage & 1) ? MBUS_DIF_STORAGE_MASK : 0 ) | ( difes ? MBUS_DIF_EXTENSION_MASK : 0 );
+	n++;
+	for(uint8_t i=0; i<difes; i++){
+		if(out) out[n] = ( (storage >> (4*i + 1)) & MBUS_DIFE_STORAGE_MASK ) | ( ( (tariff >> (2*i)) & 0x03 ) << 4 ) |
+			( ( (subunit >> i) & 0x01 ) << 6 ) | ( (i < difes - 1) ? MBUS_DIFE_EXTENSION_MASK : 0 );
+		n++;
+	}
+	
+	//VIF and VIFEs as packed by MbusParseDataRecord(), most significant byte first
+	uint8_t shift = 56;
+	while( shift && !( (key->vif_vife >> shift) & 0xFF ) ) shift -= 8;
+	for(;;){
+		if(out) out[n] = (key->vif_vife >> shift) & 0xFF;
+		n++;
+		if(!shift) break;
+		shift -= 8;
+	}
+	return n;
+}
+
+/* void Mbus::mbus_build_selection_frame():
+ * 
+ * Build the "select data records for readout" frame (SND_UD, CI 0x51)
+ * from the record keys of the sensors, once. Control field, address and
+ * checksum are filled in when it is sent. If the records do not fit into
+ * a single frame, selective readout is not used.
+ * */
+void Mbus::mbus_build_selection_frame() {
+	if( !this->mbus_selective_readout_ || !this->record_count_ ) return;
+	uint16_t payload = 3; //control, address, control information
+	for(uint16_t i=0; i<this->record_count_; i++) payload += mbus_encode_record_selection(&(this->record_keys_[i]), nullptr);
+	if(payload > 255){
+		ESP_LOGW(TAG, " %s: Too many records for selective readout, reading out all", this->mbus_address_str_);
+		return;
+	}
+	this->mbus_selection_frame_len_ = payload + 6;
+	uint8_t* frame = new uint8_t[this->mbus_selection_frame_len_];
+	frame[0] = mbus_long_frame_;
+	frame[1] = frame[2] = payload;
+	frame[3] = mbus_long_frame_;
+	frame[6] = mbus_ci_select_records_;
+	uint16_t pos = 7;
+	for(uint16_t i=0; i<this->record_count_; i++) pos += mbus_encode_record_selection(&(this->record_keys_[i]), &frame[pos]);
+	frame[this->mbus_selection_frame_len_ - 1] = 0x16;
+	this->mbus_selection_frame_ = frame;
+}
+
+/* whether to ask the meter for the sensors' records only before requesting data:
+ * not during bus scan, and not any more if the meter repeatedly did not acknowledge
+ * */
+bool Mbus::mbus_selection_pending() {
+	return this->mbus_selection_frame_ && !this->mbus_selection_sent_ && !this->mbus_scanning_ &&
+		(this->mbus_selection_failures_ < mbus_max_retries_);
+}
+
+/* uint64_t Mbus::mbus_select_address():
+ * 
+ * If the configured secondary address contains wildcards and the uart has
+ * been scanned, resolve it to the single matching meter found, so that no
+ * other meter can answer the select. Otherwise use it as configured.
+ * */
+uint64_t Mbus::mbus_select_address() {
+	const struct MbusScanResult* scanned = this->mbus_bus_->scan_result;
+	if( !scanned || !mbus_address_has_wildcard(this->secondary_address) ) return this->secondary_address;
+	uint8_t matches = 0;
+	uint64_t found = this->secondary_address;
+	for(uint8_t i=0; i<scanned->count; i++){
+		if(mbus_address_matches(this->secondary_address, scanned->addresses[i])){
+			matches++;
+			found = scanned->addresses[i];
+		}
+	}
+	if(matches == 1) return found;
+	if(matches > 1){
+		ESP_LOGW(TAG, " %s: Wildcard address matches %d meters found by bus scan, expect collisions", this->mbus_address_str_, matches);
+	}
+	return this->secondary_address;
+}
+
+/* uint64_t Mbus::mbus_scan_probe_address():
+ * 
+ * Bus scan walks the wildcard tree of the 8 ID digits: digits up to
+ * this->mbus_scan_depth_ are specified, the rest (and manufacturer,
+ * version, medium) are wildcards.
+ * */
+uint64_t Mbus::mbus_scan_probe_address() {
+	uint64_t id = 0;
+	for(uint8_t d=0; d<8; d++){
+		id = (id << 4) | ( (d <= this->mbus_scan_depth_) ? this->mbus_scan_digit_[d] : 0x0F );
+	}
+	return (id << 32) | 0xFFFFFFFF;
+}
+
+/* void Mbus::mbus_scan_next(bool collision, uint32_t now_):
+ * 
+ * Advance the bus scan after the probe of the current address: on collision
+ * descend into the next digit, otherwise move on to the next sibling,
+ * backtracking as needed. Ends the scan after the last probe.
+ * */
+void Mbus::mbus_scan_next(bool collision, uint32_t now_) {
+	if(collision){
+		if(this->mbus_scan_depth_ < 7){
+			this->mbus_scan_depth_++;
+			this->mbus_scan_digit_[this->mbus_scan_depth_] = 0;
+			this->mbus_state_ = MBUS_STATE_SCAN_PROBE;
+			return;
+		}
+		ESP_LOGW(TAG, " %s: Scan: unresolvable collision at %016" PRIX64, this->mbus_address_str_, this->mbus_scan_probe_address());
+	}
+	while(++this->mbus_scan_digit_[this->mbus_scan_depth_] > 9){
+		if(!this->mbus_scan_depth_){
+			//all probed, scan done
+			ESP_LOGI(TAG, " %s: Scan done, %d meters found", this->mbus_address_str_, this->mbus_scan_result_->count);
+			this->mbus_scan_save();
+			this->mbus_scanning_ = false;
+			this->mbus_state_ = MBUS_STATE_IDLE;
+			this->mbus_release_bus(false, now_);
+			return;
+		}
+		this->mbus_scan_depth_--;
+	}
+	this->mbus_state_ = MBUS_STATE_SCAN_PROBE;
+}
+
+/* secondary address in hex, or "primary" and the primary address if the
+ * meter is read at that
+ * */
+void Mbus::mbus_format_address() {
+	if(this->mbus_primary_addressing_) snprintf(this->mbus_address_str_, sizeof(this->mbus_address_str_), "primary %d", this->primary_address);
+	else snprintf(this->mbus_address_str_, sizeof(this->mbus_address_str_), "%" PRIx64, this->secondary_address);
+}
+
+/* persist the scan result in its compact form, if it fits
+ * */
+void Mbus::mbus_scan_save() {
+	const struct MbusScanResult* result = this->mbus_scan_result_;
+	struct MbusScanCache cache{};
+	struct MbusScanCachePage pages[mbus_scan_cache_pages_] = {};
+	if(result->count > this->mbus_scan_cache_size_){
+		ESP_LOGW(TAG, " %s: Scan result of %d meters not cached, more than scan_cache_size %d, scanning again at next boot",
+			this->mbus_address_str_, result->count, this->mbus_scan_cache_size_);
+		return;
+	}
+	for(uint8_t i=0; i<result->count; i++){
+		uint32_t header = (uint32_t) result->addresses[i];
+		uint8_t h = 0;
+		while( (h < cache.header_count) && (cache.headers[h] != header) ) h++;
+		if(h == cache.header_count){
+			if(cache.header_count == mbus_scan_cache_headers_){
+				ESP_LOGW(TAG, " %s: Scan result not cached, meters of more than %d kinds, scanning again at next boot",
+					this->mbus_address_str_, mbus_scan_cache_headers_);
+				return;
+			}
+			cache.headers[cache.header_count++] = header;
+		}
+		struct MbusScanCachePage* page = &pages[i / mbus_scan_cache_page_meters_];
+		page->header_index[i % mbus_scan_cache_page_meters_] = h;
+		page->ids[i % mbus_scan_cache_page_meters_] = (uint32_t) ( result->addresses[i] >> 32 );
+	}
+	cache.count = result->count;
+	//fails if there was no room left for the preferences
+	bool saved = true;
+	for(uint8_t p=0; p * mbus_scan_cache_page_meters_ < cache.count; p++) saved = this->mbus_scan_pages_[p].save(&pages[p]) && saved;
+	if( !saved || !this->mbus_scan_pref_.save(&cache) ){
+		ESP_LOGW(TAG, " %s: Could not save scan result, scanning again at next boot", this->mbus_address_str_);
+	}
+}
+
+/* restore the scan result from flash, false if there is none
+ * */
+bool Mbus::mbus_scan_load() {
+	struct MbusScanCache cache;
+	struct MbusScanCachePage page;
+	if( !this->mbus_scan_pref_.load(&cache) || (cache.count > this->mbus_scan_cache_size_) ||
+		(cache.header_count > mbus_scan_cache_headers_) ) return false;
+	for(uint8_t i=0; i<cache.count; i++){
+		uint8_t j = i % mbus_scan_cache_page_meters_;
+		if( !j && !this->mbus_scan_pages_[i / mbus_scan_cache_page_meters_].load(&page) ) return false;
+		if(page.header_index[j] >= cache.header_count) return false;
+		this->mbus_scan_result_->addresses[i] = ( (uint64_t) page.ids[j] << 32 ) | cache.headers[page.header_index[j]];
+	}
+	this->mbus_scan_result_->count = cache.count;
+	return true;
+}
+
+void Mbus::set_scan_bus(const std::string &cache_key) {
+	this->mbus_scan_bus_ = true;
+	this->mbus_scan_result_ = new MbusScanResult();
+	this->mbus_scan_cache_hash_ = fnv1_hash("mbus_scan_" + cache_key);
+}
+
+void Mbus::set_aes_key(const std::string &key) {
+	uint8_t aes_key[MBUS_AES_BLOCK_LEN];
+	if( !parse_hex(key, aes_key, MBUS_AES_BLOCK_LEN) || !this->mbus_aes_.set_key(aes_key) ){
+		ESP_LOGE(TAG, " %s: Invalid aes_key, or no AES on this platform", this->mbus_address_str_);
+	}
+}
+
 void Mbus::setup() {
-	uint32_t tbit_us;
 	//statemachine
- mbus_uart_locked_ = false;
+ uint32_t now_ = this->mbus_clock_();
+ this->mbus_bus_ = mbus_bus_for(this->parent_, this->mbus_clock_);
+ Mbus** last = &(this->mbus_bus_->meters);
+ while(*last) last = &((*last)->mbus_bus_next_);
+ *last = this;
+ if(this->mbus_max_bus_utilization_ < this->mbus_bus_->max_utilization) this->mbus_bus_->max_utilization = this->mbus_max_bus_utilization_;
  this->mbus_state_ = MBUS_STATE_IDLE;
  this->mbus_update_due_ = false;
  
- //baudrate-dependent timeouts
- tbit_us = 1000000 / this->parent_->get_baud_rate();
- this->mbus_timeout_short_ = ( (330 + 11) * tbit_us ) / 1000;
- this->mbus_timeout_short_ += 150;
- this->mbus_timeout_long_ = ( (330 + 11 + (11*512)) * tbit_us ) / 1000;
- this->mbus_timeout_long_ += 150;
+ //baudrate-dependent timeouts, the uart is always back at this rate between transactions
+ this->mbus_base_baud_rate_ = this->parent_->get_baud_rate();
+ this->mbus_set_timeouts(this->mbus_base_baud_rate_);
  
  //prepare "select secondary address" frame
- for(int i=0; i<=mbus_select_frame_len_-1;i++) this->mbus_select_frame_[i]=mbus_select_frame_raw_[i];
- this->mbus_select_frame_[7] = (uint8_t) ( this->secondary_address >> (4*8) );
- this->mbus_select_frame_[8] = (uint8_t) ( this->secondary_address >> (5*8) );
- this->mbus_select_frame_[9] = (uint8_t) ( this->secondary_address >> (6*8) );
- this->mbus_select_frame_[10] = (uint8_t) ( this->secondary_address >> (7*8) );
- this->mbus_select_frame_[11] = (uint8_t) ( this->secondary_address >> (3*8) );
- this->mbus_select_frame_[12] = (uint8_t) ( this->secondary_address >> (2*8) );
- this->mbus_select_frame_[13] = (uint8_t) ( this->secondary_address >> (1*8) );
- this->mbus_select_frame_[14] = (uint8_t) ( this->secondary_address >> (0*8) );
- this->mbus_select_frame_[15] = mbus_checksum(mbus_select_frame_);
+ this->mbus_build_select_frame(this->secondary_address);
+ 
+ //cached bus scan result, or scan before first readout
+ if(this->mbus_scan_bus_){
+	 //all pages are made now, flash preferences of the ESP8266 are laid out in the order they are made
+	 this->mbus_scan_pref_ = global_preferences->make_preference<struct MbusScanCache>(this->mbus_scan_cache_hash_, true);
+	 for(uint8_t p=0; p * mbus_scan_cache_page_meters_ < this->mbus_scan_cache_size_; p++){
+		 this->mbus_scan_pages_[p] = global_preferences->make_preference<struct MbusScanCachePage>(this->mbus_scan_cache_hash_ + 1 + p, true);
+	 }
+	 if(this->mbus_scan_load()){
+		 ESP_LOGI(TAG, " %s: Using cached bus scan result, %d meters", this->mbus_address_str_, this->mbus_scan_result_->count);
+	 } else {
+		 this->mbus_scan_result_->count = 0;
+		 this->scan();
+	 }
+	 this->mbus_bus_->scan_result = this->mbus_scan_result_;
+ }
+ 
+ //prepare "select data records for readout" frame
+ this->mbus_build_selection_frame();
+ 
+ //prepare "request data" frame, addressed either to the selected meter
+ //(network layer address) or directly to the meter's primary address
+ for(size_t i=0; i<mbus_request_frame_len_;i++) this->mbus_request_frame_[i]=mbus_request_frame_raw_[i];
+ this->mbus_request_frame_[2] = this->primary_address;
+ this->mbus_request_frame_[3] = this->mbus_request_frame_[1] + this->mbus_request_frame_[2];
 
  //signal to sensors
  this->telegram_count=0;
+ this->mbus_last_callback_ = now_;
+ this->mbus_last_trace_ = now_ - this->mbus_trace_interval_;
+ this->mbus_deadline_ = now_;
+#ifdef USE_BINARY_SENSOR
+ if(this->suspended_binary_sensor_) this->suspended_binary_sensor_->publish_initial_state(false);
+#endif
+ 
+ //the state machine runs from a single interval, set up once: starting a readout does not
+ //allocate a scheduler item, while idle the interval only finds that there is nothing to do
+ this->set_interval("mbus", mbus_tick_ms_, [this]() { this->mbus_tick(); });
+ 
+ //staggered polling, from that interval as well
+ if(this->mbus_update_offset_){
+	 this->stop_poller();
+	 this->mbus_next_poll_ = now_ + this->mbus_update_offset_;
+	 return;
+ }
+ //the first meter on the bus with the same update_interval polls this one along with it,
+ //whatever the phases of their pollers, so they are read in one sweep
+ for(Mbus* meter = this->mbus_bus_->meters; meter != this; meter = meter->mbus_bus_next_){
+	 if( meter->mbus_update_offset_ || meter->mbus_sweep_leader_ ) continue;
+	 if(meter->get_update_interval() != this->get_update_interval()) continue;
+	 this->mbus_sweep_leader_ = meter;
+	 this->stop_poller();
+	 break;
+ }
+}
+
+/* void Mbus::mbus_transaction_failed(uint32_t now):
+ * 
+ * Circuit breaker: after mbus_suspend_failures_ failed transactions in a
+ * row, the meter is suspended. Polls are skipped until a backoff, starting
+ * at update_interval and doubling with every failed probe, has passed. The
+ * next poll then probes it with a single attempt; if that succeeds, it is a
+ * regular readout and the meter is resumed.
+ * */
+void Mbus::mbus_transaction_failed(uint32_t now) {
+  if(this->mbus_scanning_) return;
+  if( !this->mbus_suspended_ && (++this->mbus_failures_ < mbus_suspend_failures_) ) return;
+  if(!this->mbus_backoff_) this->mbus_backoff_ = this->get_update_interval();
+  else if(this->mbus_backoff_ < mbus_backoff_max_ms_ / 2) this->mbus_backoff_ *= 2;
+  else this->mbus_backoff_ = mbus_backoff_max_ms_;
+  this->mbus_resume_at_ = now + this->mbus_backoff_;
+  ESP_LOGW(TAG, " %s: Meter not responding, suspended, next probe in %u s", this->mbus_address_str_,
+    this->mbus_backoff_ / 1000);
+  this->mbus_set_suspended(true);
+}
+
+void Mbus::mbus_set_suspended(bool suspended) {
+  if(suspended == this->mbus_suspended_) return;
+  if(!suspended) ESP_LOGI(TAG, " %s: Meter responding again, resumed", this->mbus_address_str_);
+  else this->mbus_stats_.suspensions++;
+  this->mbus_suspended_ = suspended;
+#ifdef USE_BINARY_SENSOR
+  if(this->suspended_binary_sensor_) this->suspended_binary_sensor_->publish_state(suspended);
+#endif
+}
+
+/* bool Mbus::mbus_poll_before(const Mbus* other, uint32_t now):
+ * 
+ * Whether this meter is to be read before other. Meters past their deadline
+ * come first, earliest deadline first, so no meter starves. Of the others,
+ * higher priority comes first, then earlier deadline.
+ * */
+bool Mbus::mbus_poll_before(const Mbus* other, uint32_t now) const {
+  bool overdue = (int32_t) (now - this->mbus_deadline_) >= 0;
+  bool other_overdue = (int32_t) (now - other->mbus_deadline_) >= 0;
+  if(overdue != other_overdue) return overdue;
+  if( !overdue && (this->mbus_priority_ != other->mbus_priority_) ) return this->mbus_priority_ > other->mbus_priority_;
+  return (int32_t) (this->mbus_deadline_ - other->mbus_deadline_) < 0;
 }
 
-void Mbus::loop() {
-  uint32_t now_;
+/* whether the bus has been held for more of the current utilization window
+ * than its max_utilization allows: the next transaction then waits until
+ * the bus has been idle long enough, so utilization stays bounded within
+ * a transaction
+ * */
+static bool mbus_bus_throttled(const struct MbusBus* bus, uint32_t now) {
+  if(bus->max_utilization >= 100.0f) return false;
+  return 100.0f * bus->busy_ms > bus->max_utilization * (now - bus->window_start);
+}
+
+/* the meter waiting for the bus that gets it next, nullptr if none is waiting
+ * */
+Mbus* Mbus::mbus_bus_pick(uint32_t now) const {
+  const struct MbusBus* bus = this->mbus_bus_;
+  Mbus* first = ( bus->last && bus->last->mbus_bus_next_ ) ? bus->last->mbus_bus_next_ : bus->meters;
+  Mbus* meter = first;
+  Mbus* next = nullptr;
+  do {
+	  if( (meter->mbus_state_ == MBUS_STATE_AWAIT_LOCK) && ( !next || meter->mbus_poll_before(next, now) ) ) next = meter;
+	  meter = meter->mbus_bus_next_ ? meter->mbus_bus_next_ : bus->meters;
+  } while(meter != first);
+  return next;
+}
+
+/* void Mbus::mbus_release_bus(bool clean, uint32_t now):
+ * 
+ * Release the bus at the end of a transaction. The sweep continues if
+ * another meter is waiting and the transaction ended cleanly; after a
+ * failure or a bus scan, the next transaction resets the bus again.
+ * */
+void Mbus::mbus_release_bus(bool clean, uint32_t now) {
+  struct MbusBus* bus = this->mbus_bus_;
+  bus->owner = nullptr;
+#ifdef MBUS_RX_TASK
+  if(bus->rx) mbus_rx_set_active(bus->rx, false);
+#endif
+  bus->last = this;
+  bus->swept = bus->swept && clean && this->mbus_bus_pick(now);
   
-  now_=App.get_loop_component_start_time();
+  bus->busy_ms += now - bus->busy_since;
+  if(now - bus->window_start >= mbus_utilization_window_ms_){
+	  bus->utilization = 100.0f * bus->busy_ms / (now - bus->window_start);
+	  bus->busy_ms = 0;
+	  bus->window_start = now;
+  }
+}
+
+/* record the latency of a phase that ends now, the next one starts now
+ * */
+void Mbus::mbus_record_phase(enum MbusPhase phase, uint32_t now) {
+  if(this->mbus_scanning_) return;
+  struct MbusPhaseStats* stats = &(this->mbus_stats_.phases[phase]);
+  uint32_t ms = now - ( (phase == MBUS_PHASE_TRANSACTION) ? this->mbus_transaction_start_ : this->mbus_phase_start_ );
+  uint8_t bucket = 0;
+  while( (bucket < mbus_stats_buckets_ - 1) && (ms >= (16UL << bucket)) ) bucket++;
+  stats->last_ms = ms;
+  if(ms > stats->max_ms) stats->max_ms = ms;
+  stats->sum_ms += ms;
+  stats->count++;
+  stats->histogram[bucket]++;
+  this->mbus_trace_phase_ms_[phase] += ms;
+  this->mbus_phase_start_ = now;
+}
+
+/* void Mbus::mbus_trace(bool success, uint32_t now):
+ * 
+ * Log a single line summing up the transaction that just ended, with the
+ * time spent in each phase, and optionally its frames as hex. Called once
+ * the uart is released, so tracing does not change the timing on the bus.
+ * Transactions ending within trace_interval of the last trace are only
+ * counted.
+ * */
+void Mbus::mbus_trace(bool success, uint32_t now) {
+  if( !this->mbus_trace_interval_ || this->mbus_scanning_ ) return;
+  if(now - this->mbus_last_trace_ < this->mbus_trace_interval_){
+	  this->mbus_traces_skipped_++;
+	  return;
+  }
+  this->mbus_last_trace_ = now;
+  
+  const uint32_t* ms = this->mbus_trace_phase_ms_;
+  ESP_LOGI(TAG, " %s: Trace: %s, %d frames, %d retries, %u baud, reset %u ms, select %u ms, header %u ms, "
+    "data %u ms, total %u ms, %u transactions not traced", this->mbus_address_str_,
+    !success ? "failed" : this->mbus_readout_changed_ ? "changed" : "unchanged",
+    this->mbus_frame_count_, mbus_max_retries_ - this->mbus_retry_count_,
+    //meter back at base rate by now: would it be switched again, it was read at max rate
+    this->mbus_baud_negotiate() ? this->mbus_max_baud_rate_ : this->mbus_base_baud_rate_,
+    ms[MBUS_PHASE_RESET], ms[MBUS_PHASE_SELECT], ms[MBUS_PHASE_HEADER], ms[MBUS_PHASE_DATA],
+    now - this->mbus_transaction_start_, this->mbus_traces_skipped_);
+  this->mbus_traces_skipped_ = 0;
+  
+  if(!this->mbus_trace_hexdump_) return;
+  //the newest frames in the history are those of this transaction, unless they did not fit
+  struct MbusTelegramRef ref;
+  uint16_t count = this->mbus_history_.size();
+  uint16_t first = ( count > this->mbus_frame_count_ ) ? count - this->mbus_frame_count_ : 0;
+  for(uint16_t i=first; this->mbus_history_.get(i, &ref); i++){
+    ESP_LOGI(TAG, " %s: Trace: frame %d, %d bytes", this->mbus_address_str_, i - first + 1, ref.len);
+    this->mbus_log_hex(ref.data, ref.len);
+  }
+}
+
+float Mbus::get_statistic(enum MbusStatistic statistic) const {
+  const struct MbusStats* stats = &(this->mbus_stats_);
+  const struct MbusPhaseStats* phase;
+  switch(statistic){
+    case MBUS_STATISTIC_TRANSACTIONS: return stats->transactions;
+    case MBUS_STATISTIC_FAILED_TRANSACTIONS: return stats->failed_transactions;
+    case MBUS_STATISTIC_RETRIES: return stats->retries;
+    case MBUS_STATISTIC_ACK_TIMEOUTS: return stats->ack_timeouts;
+    case MBUS_STATISTIC_HEADER_TIMEOUTS: return stats->header_timeouts;
+    case MBUS_STATISTIC_DATA_TIMEOUTS: return stats->data_timeouts;
+    case MBUS_STATISTIC_COLLISIONS: return stats->collisions;
+    case MBUS_STATISTIC_INVALID_HEADERS: return stats->invalid_headers;
+    case MBUS_STATISTIC_CHECKSUM_ERRORS: return stats->checksum_errors;
+    case MBUS_STATISTIC_BYTES_RECEIVED: return stats->bytes_received;
+    case MBUS_STATISTIC_UNCHANGED_READOUTS: return stats->unchanged_readouts;
+    case MBUS_STATISTIC_MISSED_DEADLINES: return stats->missed_deadlines;
+    case MBUS_STATISTIC_SUSPENSIONS: return stats->suspensions;
+    case MBUS_STATISTIC_BUS_UTILIZATION: return this->mbus_bus_->utilization;
+    case MBUS_STATISTIC_RESET_LATENCY: phase = &(stats->phases[MBUS_PHASE_RESET]); break;
+    case MBUS_STATISTIC_SELECT_LATENCY: phase = &(stats->phases[MBUS_PHASE_SELECT]); break;
+    case MBUS_STATISTIC_HEADER_LATENCY: phase = &(stats->phases[MBUS_PHASE_HEADER]); break;
+    case MBUS_STATISTIC_DATA_LATENCY: phase = &(stats->phases[MBUS_PHASE_DATA]); break;
+    case MBUS_STATISTIC_TRANSACTION_LATENCY: phase = &(stats->phases[MBUS_PHASE_TRANSACTION]); break;
+    default: return NAN;
+  }
+  if(!phase->count) return NAN;
+  return (float) phase->sum_ms / phase->count;
+}
+
+/* Start running the state machine from the "mbus" interval, unless it is already running.
+ * While there is nothing to do, it is not run at all.
+ * */
+void Mbus::mbus_start() {
+  this->mbus_running_ = true;
+}
+
+/* void Mbus::mbus_tick():
+ * 
+ * The "mbus" interval, every mbus_tick_ms_: polls a meter with update_offset
+ * when due, and runs the state machine while there is something to do.
+ * */
+void Mbus::mbus_tick() {
+  uint32_t now_ = this->mbus_clock_();
+  //at the offset from setup plus multiples of update_interval; polls missed by a whole interval are dropped
+  if( this->mbus_update_offset_ && ( (int32_t) (now_ - this->mbus_next_poll_) >= 0 ) ){
+	  this->mbus_next_poll_ += this->get_update_interval();
+	  if( (int32_t) (now_ - this->mbus_next_poll_) >= 0 ) this->mbus_next_poll_ = now_ + this->get_update_interval();
+	  this->update();
+  }
+  if(this->mbus_running_) this->mbus_statemachine(now_);
+}
+
+/* void Mbus::mbus_statemachine(uint32_t now_):
+ * 
+ * One tick of the state machine. All timing is relative to now_, which the
+ * caller reads from the clock of the instance (see set_clock()), so the
+ * state machine can just as well be driven on simulated time, against a
+ * simulated uart.
+ * */
+void Mbus::mbus_statemachine(uint32_t now_) {
+  uint32_t ack_timeout_;
+  uint32_t response_timeout_;
+  
+  //during bus scan, different meters answer, so nothing is learned and the worst case is assumed
+  if(this->mbus_scanning_){
+	  ack_timeout_ = this->mbus_timeout_short_;
+	  response_timeout_ = this->mbus_timeout_long_;
+  } else {
+	  ack_timeout_ = this->mbus_learned_timeout(&(this->mbus_ack_latency_), this->mbus_timeout_short_);
+	  response_timeout_ = this->mbus_learned_timeout(&(this->mbus_response_latency_), this->mbus_timeout_long_);
+  }
   
   switch(this->mbus_state_){
 	  default:
-	  ESP_LOGE(TAG, "%llx STATEMACHINE IN UNKNOWN STATE, RESETTING", this->secondary_address);
+	  ESP_LOGE(TAG, "%s STATEMACHINE IN UNKNOWN STATE, RESETTING", this->mbus_address_str_);
 	  this->mbus_state_ = MBUS_STATE_IDLE;
-	  mbus_uart_locked_ = false;
+	  this->mbus_release_bus(false, now_);
 	  break;
 	  
 	  case MBUS_STATE_IDLE:
+	  if(this->mbus_scan_due_){
+		  this->mbus_scan_due_ = false;
+		  this->mbus_scanning_ = true;
+		  this->mbus_state_ = MBUS_STATE_AWAIT_LOCK;
+		  break;
+	  }
 	  if(this->mbus_update_due_){
 		  this->mbus_update_due_ = false;
 		  this->mbus_state_ = MBUS_STATE_AWAIT_LOCK;
       }
 	  break;
 	  
-	  //wait until no other mbus instances are using the uart, then locking it for ourselves
+	  //wait until no other mbus instances are using our uart, it is in its utilization bound and it is our turn,
+	  //then locking it for ourselves
 	  case MBUS_STATE_AWAIT_LOCK:
-	  if(mbus_uart_locked_)break;
-	  mbus_uart_locked_ = true;
-	  this->mbus_retry_count_ = mbus_max_retries_;
+	  if( this->mbus_bus_->owner || mbus_bus_throttled(this->mbus_bus_, now_) || (this->mbus_bus_pick(now_) != this) ) break;
+	  this->mbus_bus_->owner = this;
+#ifdef MBUS_RX_TASK
+	  if(this->mbus_bus_->rx) mbus_rx_set_active(this->mbus_bus_->rx, true);
+#endif
+	  this->mbus_bus_->busy_since = now_;
+	  //a suspended meter is probed with a single attempt, selecting it without resetting the bus first
+	  this->mbus_retry_count_ = this->mbus_suspended_ ? 1 : mbus_max_retries_;
+	  this->mbus_frame_count_ = 0;
+	  this->mbus_baud_fallback_ = false;
+	  this->mbus_readout_changed_ = false;
+	  this->mbus_selection_sent_ = false;
+	  this->mbus_transaction_start_ = now_;
+	  memset(this->mbus_trace_phase_ms_, 0, sizeof(this->mbus_trace_phase_ms_));
+	  if(this->mbus_scanning_){
+		  ESP_LOGI(TAG, " %s: Scanning bus", this->mbus_address_str_);
+		  this->mbus_scan_result_->count = 0;
+		  this->mbus_scan_depth_ = 0;
+		  this->mbus_scan_digit_[0] = 0;
+		  this->mbus_state_ = MBUS_STATE_BUS_RESET_PRE;
+		  break;
+	  }
+	  if(this->mbus_primary_addressing_){
+		  /* no SND_NKE precedes the request, so the FCB is toggled for every new
+		   * transaction (but not for retries), telling the meter to send fresh data
+		   * instead of repeating its last response */
+		  this->mbus_request_frame_[1] ^= mbus_control_fcb_;
+		  this->mbus_request_frame_[3] = this->mbus_request_frame_[1] + this->mbus_request_frame_[2];
+		  this->mbus_stats_.transactions++;
+		  this->mbus_state_ = MBUS_STATE_REQUEST_DATA;
+		  break;
+	  }
+	  this->mbus_stats_.transactions++;
+	  this->mbus_build_select_frame(this->mbus_select_address());
+	  this->mbus_skip_reset_ = this->mbus_bus_->swept || this->mbus_suspended_;
 	  this->mbus_state_ = MBUS_STATE_BUS_RESET_PRE;
 	  break;
 	  
 	  //resetting the bus
 	  case MBUS_STATE_BUS_RESET_PRE:
+	  this->mbus_frame_count_ = 0;
+	  this->mbus_selection_sent_ = false;
+	  this->mbus_phase_start_ = now_;
+	  //bus already reset in this sweep, retries reset it again; the meter may have been read since,
+	  //so the FCB is toggled from the last request, or the meter would repeat its last response
+	  if(this->mbus_skip_reset_){
+		  this->mbus_skip_reset_ = false;
+		  this->mbus_request_frame_[1] ^= mbus_control_fcb_;
+		  this->mbus_request_frame_[3] = this->mbus_request_frame_[1] + this->mbus_request_frame_[2];
+		  MBUS_LOGD(TAG, " %s: bus reset earlier in this sweep", this->mbus_address_str_);
+		  this->mbus_rx_purge();
+		  this->mbus_state_ = MBUS_STATE_SELECT;
+		  break;
+	  }
+	  //meter forgets about FCB on reset, so does the readout restart
+	  this->mbus_request_frame_[1] = mbus_request_frame_raw_[1];
+	  this->mbus_request_frame_[3] = this->mbus_request_frame_[1] + this->mbus_request_frame_[2];
 	  this->write_array(mbus_reset_frame_, mbus_reset_frame_len_);
-	  ESP_LOGD(TAG, " %llx: sending first bus reset", this->secondary_address);
+	  MBUS_LOGD(TAG, " %s: sending first bus reset", this->mbus_address_str_);
 	  this->mbus_timer_ = now_;
 	  this->mbus_state_ = MBUS_STATE_BUS_RESET;
 	  break;
 	  
 	  case MBUS_STATE_BUS_RESET:
-	  if(now_ < this->mbus_timer_ + this->mbus_timeout_short_) break;
+	  if(now_ - this->mbus_timer_ < ack_timeout_) break;
 	  //sending another reset, as the first may be lost
-	  ESP_LOGD(TAG, " %llx: sending second bus reset", this->secondary_address);
+	  MBUS_LOGD(TAG, " %s: sending second bus reset", this->mbus_address_str_);
 	  this->write_array(mbus_reset_frame_, mbus_reset_frame_len_);
 	  this->mbus_timer_ = now_;
 	  this->mbus_state_ = MBUS_STATE_BUS_RESET_2;
 	  break;
 	  
 	  case MBUS_STATE_BUS_RESET_2:
-	  if(now_ < this->mbus_timer_ + this->mbus_timeout_short_) break;
+	  if(now_ - this->mbus_timer_ < ack_timeout_) break;
 	  //purge rx buffer
-	  ESP_LOGD(TAG, " %llx: purging rx buffer", this->secondary_address);
-	  while(this->available()) this->read_array( this->telegram, 1 ) ;
+	  MBUS_LOGD(TAG, " %s: purging rx buffer", this->mbus_address_str_);
+	  this->mbus_rx_purge();
+	  this->mbus_bus_->swept = true;
+	  if(this->mbus_scanning_){
+		  this->mbus_state_ = MBUS_STATE_SCAN_PROBE;
+		  break;
+	  }
+	  this->mbus_state_ = MBUS_STATE_SELECT;
+	  // fall through
+	  
 	  //select device on bus
-	  ESP_LOGD(TAG, " %llx: sending SELECT SECONDARY ADDRESS command", this->secondary_address);
+	  case MBUS_STATE_SELECT:
+	  this->mbus_record_phase(MBUS_PHASE_RESET, now_);
+	  MBUS_LOGD(TAG, " %s: sending SELECT SECONDARY ADDRESS command", this->mbus_address_str_);
 	  this->write_array(this->mbus_select_frame_, mbus_select_frame_len_);
 	  this->mbus_timer_ = now_;
 	  this->mbus_state_ = MBUS_STATE_AWAIT_SELSCT_SA;
 	  break;
 	  
 	  case MBUS_STATE_AWAIT_SELSCT_SA:
-	  if(!this->available()){
-		  if(now_ < this->mbus_timer_ + this->mbus_timeout_short_) break;
+	  if(!this->mbus_rx_available()){
+		  if(now_ - this->mbus_timer_ < ack_timeout_) break;
 		  else {
-			  ESP_LOGE(TAG, "%llx: Timeout while waiting for ACK", this->secondary_address);
+			  if(this->mbus_scanning_){
+				  this->mbus_scan_next(false, now_);
+				  break;
+			  }
+			  ESP_LOGE(TAG, "%s: Timeout while waiting for ACK", this->mbus_address_str_);
+			  this->mbus_stats_.ack_timeouts++;
+			  //meter may have slowed down, forget its latency and retry with the worst case timeout
+			  this->mbus_ack_latency_.samples = 0;
 			  this->mbus_state_ = MBUS_STATE_RETRY;
 			  break;
 		  }
 	  } else {
-		  this->read_byte(this->telegram);
+		  this->mbus_rx_read(this->telegram, 1);
 		  if( this->telegram[0] != mbus_ack_ ){
-			  ESP_LOGE(TAG, "%llx: Collision while waiting for ACK", this->secondary_address);
+			  if(this->mbus_scanning_){
+				  this->mbus_scan_next(true, now_);
+				  break;
+			  }
+			  ESP_LOGE(TAG, "%s: Collision while waiting for ACK", this->mbus_address_str_);
+		  this->mbus_stats_.collisions++;
 			  this->mbus_state_ = MBUS_STATE_RETRY;
 			  break;
 		  }
-		  this->mbus_timer_ = now_;
+		  uint32_t ack_at = this->mbus_rx_first_at(now_);
+		  if(!this->mbus_scanning_) this->mbus_learn_latency(&(this->mbus_ack_latency_), ack_at - this->mbus_timer_);
+		  this->mbus_timer_ = ack_at;
 		  this->mbus_state_ = MBUS_STATE_AWAIT_SELSCT_SA_2;
 		  break;
 	  }
 	  
 	  //if we got acknowledge, that does not exclude further collision
 	  case MBUS_STATE_AWAIT_SELSCT_SA_2:
-	  if(this->available()){
-		  ESP_LOGE(TAG, "%llx: Collision while waiting for ACK", this->secondary_address);
+	  if(this->mbus_rx_available()){
+		  if(this->mbus_scanning_){
+			  this->mbus_scan_next(true, now_);
+			  break;
+		  }
+		  ESP_LOGE(TAG, "%s: Collision while waiting for ACK", this->mbus_address_str_);
+		  this->mbus_stats_.collisions++;
 		  this->mbus_state_ = MBUS_STATE_RETRY;
 		  break;
 	  }
-	  if(now_ < this->mbus_timer_ + this->mbus_timeout_short_) break;
-	  //ack without collision --> request data
-	  ESP_LOGD(TAG, " %llx: sending REQUEST DATA command", this->secondary_address);
-	  this->write_array(mbus_request_frame_, mbus_request_frame_len_);
+	  //any colliding meter answers within about the same time as ours
+	  if(now_ - this->mbus_timer_ < ack_timeout_) break;
+	  //ack without collision --> switch to higher baud rate and select records, or request data right away
+	  this->mbus_record_phase(MBUS_PHASE_SELECT, now_);
+	  if( this->mbus_baud_negotiate() || this->mbus_selection_pending() ){
+		  this->mbus_state_ = MBUS_STATE_REQUEST_DATA;
+		  break;
+	  }
+	  MBUS_LOGD(TAG, " %s: sending REQUEST DATA command", this->mbus_address_str_);
+	  this->write_array(this->mbus_request_frame_, mbus_request_frame_len_);
+	  this->mbus_timer_ = now_;
+	  this->mbus_phase_start_ = now_;
+	  this->mbus_rx_started_ = false;
+	  this->mbus_state_ = MBUS_STATE_AWAIT_HEADER;
+	  break;
+	  
+	  //primary addressing: no reset and select, requesting data right away
+	  //(also entered after select, or after switching baud rate)
+	  case MBUS_STATE_REQUEST_DATA:
+	  MBUS_LOGD(TAG, " %s: purging rx buffer", this->mbus_address_str_);
+	  this->mbus_rx_purge();
+	  if(this->mbus_baud_negotiate()){
+		  MBUS_LOGD(TAG, " %s: sending SWITCH BAUDRATE command, %d baud", this->mbus_address_str_, this->mbus_max_baud_rate_);
+		  this->mbus_send_baud_switch(this->mbus_max_baud_rate_);
+		  //the FCB used by the switch command is used up
+		  this->mbus_request_frame_[1] ^= mbus_control_fcb_;
+		  this->mbus_request_frame_[3] = this->mbus_request_frame_[1] + this->mbus_request_frame_[2];
+		  this->mbus_timer_ = now_;
+		  this->mbus_state_ = MBUS_STATE_AWAIT_BAUD_ACK;
+		  break;
+	  }
+	  if(this->mbus_selection_pending()){
+		  MBUS_LOGD(TAG, " %s: sending SELECT DATA RECORDS command, %d records", this->mbus_address_str_, this->record_count_);
+		  uint8_t* frame = this->mbus_selection_frame_;
+		  frame[4] = mbus_control_snd_ud_ | (this->mbus_request_frame_[1] & mbus_control_fcb_);
+		  frame[5] = this->mbus_request_frame_[2];
+		  frame[this->mbus_selection_frame_len_ - 2] = this->mbus_checksum(frame);
+		  this->write_array(frame, this->mbus_selection_frame_len_);
+		  this->mbus_request_frame_[1] ^= mbus_control_fcb_;
+		  this->mbus_request_frame_[3] = this->mbus_request_frame_[1] + this->mbus_request_frame_[2];
+		  this->mbus_timer_ = now_;
+		  this->mbus_state_ = MBUS_STATE_AWAIT_SELECTION_ACK;
+		  break;
+	  }
+	  MBUS_LOGD(TAG, " %s: sending REQUEST DATA command to address %d", this->mbus_address_str_, this->mbus_request_frame_[2]);
+	  this->write_array(this->mbus_request_frame_, mbus_request_frame_len_);
 	  this->mbus_timer_ = now_;
+	  this->mbus_phase_start_ = now_;
+	  this->mbus_rx_started_ = false;
 	  this->mbus_state_ = MBUS_STATE_AWAIT_HEADER;
 	  break;
 	  
 	  case MBUS_STATE_AWAIT_HEADER:
-	  if(now_ > this->mbus_timer_ + this->mbus_timeout_long_){
-		  ESP_LOGE(TAG, "%llx: Timeout while waiting for header", this->secondary_address);
+	  //first byte of response seen: learning latency, then allowing for a frame of maximum length
+	  if(!this->mbus_rx_started_ && this->mbus_rx_available()){
+		  uint32_t first_at = this->mbus_rx_first_at(now_);
+		  if(!this->mbus_scanning_) this->mbus_learn_latency(&(this->mbus_response_latency_), first_at - this->mbus_timer_);
+		  this->mbus_rx_started_ = true;
+		  this->mbus_timer_ = first_at;
+	  }
+	  if(!this->mbus_rx_started_ && (now_ - this->mbus_timer_ > response_timeout_)){
+		  ESP_LOGE(TAG, "%s: Timeout while waiting for header", this->mbus_address_str_);
+		  //meter may have slowed down, forget its latency and retry with the worst case timeout
+		  this->mbus_response_latency_.samples = 0;
+		  if(!this->mbus_scanning_) this->mbus_stats_.header_timeouts++;
 		  this->mbus_state_ = MBUS_STATE_RETRY;
+		  break;
+	  }
+	  if(this->mbus_rx_started_ && (now_ - this->mbus_timer_ > this->mbus_timeout_long_)){
+		  ESP_LOGE(TAG, "%s: Timeout while waiting for header", this->mbus_address_str_);
+		  if(!this->mbus_scanning_) this->mbus_stats_.header_timeouts++;
+		  this->mbus_state_ = MBUS_STATE_RETRY;
+		  break;
 	  }
-	  if(this->available() < 3) break;
-	  this->read_array(this->telegram, 3);
+	  if(this->mbus_rx_available() < 3) break;
+	  this->mbus_rx_read(this->telegram, 3);
+	  if(!this->mbus_scanning_) this->mbus_stats_.bytes_received += 3;
 	  if( (this->telegram[0] != mbus_long_frame_) || (this->telegram[1] != this->telegram[2]) ){
-		  ESP_LOGE(TAG, "%llx: Invalid header %02hhX %02hhX %02hhX ", this->secondary_address, this->telegram[0], this->telegram[1], this->telegram[2]);
+		  ESP_LOGE(TAG, "%s: Invalid header %02hhX %02hhX %02hhX ", this->mbus_address_str_, this->telegram[0], this->telegram[1], this->telegram[2]);
+		  if(!this->mbus_scanning_) this->mbus_stats_.invalid_headers++;
+		  this->mbus_timer_ = now_;
+		  this->mbus_wait_start_ = now_;
 		  this->mbus_state_ = MBUS_STATE_RETRY_WAIT;
 		  break;
 	  }
-	  this->mbus_telegram_len_ = this->telegram[1] + 3;
-	  ESP_LOGD(TAG, " %llx: header received, len: %d", this->secondary_address, this->telegram[1]);
-	  //got header, getting the rest of frame
+	  this->mbus_telegram_len_ = this->telegram[1] + 6;
+	  MBUS_LOGD(TAG, " %s: header received, len: %d", this->mbus_address_str_, this->telegram[1]);
+	  this->mbus_record_phase(MBUS_PHASE_HEADER, now_);
+	  //got header, receiving and decoding the rest of frame as it arrives
+	  this->mbus_rx_pos_ = 3;
+	  this->mbus_rx_checksum_ = 0;
+	  this->mbus_header_state_ = MBUS_HEADER_PENDING;
+	  this->mbus_frame_record_count_ = 0;
 	  this->mbus_state_ = MBUS_STATE_AWAIT_DATA;
 	  break;
 	  
 	  case MBUS_STATE_AWAIT_DATA:
-	  if(now_ > this->mbus_timer_ + this->mbus_timeout_long_){
-		  ESP_LOGE(TAG, "%llx: Timeout while waiting for data", this->secondary_address);
+	  while( (this->mbus_rx_pos_ < this->mbus_telegram_len_) && this->mbus_rx_available() ){
+		  this->mbus_rx_read(&(this->telegram[this->mbus_rx_pos_]), 1);
+		  if(!this->mbus_scanning_) this->mbus_stats_.bytes_received++;
+		  //running checksum over control, address, control information and payload
+		  if( (this->mbus_rx_pos_ >= 4) && (this->mbus_rx_pos_ < this->mbus_telegram_len_ - 2) ){
+			  this->mbus_rx_checksum_ += this->telegram[this->mbus_rx_pos_];
+		  }
+		  this->mbus_rx_pos_++;
+	  }
+	  this->mbus_decode_frame();
+	  //timing out only on what is missing: a late tick may find the rest of the frame already received
+	  if(this->mbus_rx_pos_ < this->mbus_telegram_len_){
+		  if(now_ - this->mbus_timer_ <= this->mbus_timeout_long_) break;
+		  ESP_LOGE(TAG, "%s: Timeout while waiting for data", this->mbus_address_str_);
+		  if(!this->mbus_scanning_) this->mbus_stats_.data_timeouts++;
+		  for(uint16_t i=0; i<this->record_count_; i++) this->record_slots_[i].pending_count = 0;
 		  this->mbus_state_ = MBUS_STATE_RETRY;
+		  break;
 	  }
-	  if(this->available() < this->mbus_telegram_len_) break;
 	  //entire response received, checking checksum
-	  this->read_array(&(this->telegram[3]), this->mbus_telegram_len_);
-	  ESP_LOGD(TAG, " %llx: data received", this->secondary_address);
-	  if(this->telegram[this->mbus_telegram_len_+1] != mbus_checksum(this->telegram)) {
-		  ESP_LOGE(TAG, "%llx: Invalid checksum, expected %d", this->secondary_address, mbus_checksum(this->telegram));
+	  MBUS_LOGD(TAG, " %s: data received", this->mbus_address_str_);
+	  if(this->telegram[this->mbus_telegram_len_-2] != this->mbus_rx_checksum_) {
+		  ESP_LOGE(TAG, "%s: Invalid checksum, expected %d", this->mbus_address_str_, this->mbus_rx_checksum_);
+		  if(!this->mbus_scanning_) this->mbus_stats_.checksum_errors++;
+		  for(uint16_t i=0; i<this->record_count_; i++) this->record_slots_[i].pending_count = 0;
+		  this->mbus_timer_ = now_;
+		  this->mbus_wait_start_ = now_;
 		  this->mbus_state_ = MBUS_STATE_RETRY_WAIT;
 		  break;
 	  }
-	  //checksum ok,
-	  //signalling to sensors that there is new data to parse in telegram
-	  //and releasing uart
-	  mbus_uart_locked_ = false;
+	  //checksum ok, during bus scan only the secondary address of the meter is of interest
+	  if(this->mbus_scanning_){
+		  uint64_t found = ( (uint64_t) this->telegram[10] << (7*8) ) | ( (uint64_t) this->telegram[9] << (6*8) ) |
+			  ( (uint64_t) this->telegram[8] << (5*8) ) | ( (uint64_t) this->telegram[7] << (4*8) ) |
+			  ( (uint64_t) this->telegram[11] << (3*8) ) | ( (uint64_t) this->telegram[12] << (2*8) ) |
+			  ( (uint64_t) this->telegram[13] << (1*8) ) | ( (uint64_t) this->telegram[14] << (0*8) );
+		  ESP_LOGI(TAG, " %s: Scan: found meter %016" PRIX64, this->mbus_address_str_, found);
+		  if(this->mbus_scan_result_->count < mbus_scan_max_meters_){
+			  this->mbus_scan_result_->addresses[this->mbus_scan_result_->count++] = found;
+		  } else {
+			  ESP_LOGW(TAG, " %s: Scan: more than %d meters, ignoring", this->mbus_address_str_, mbus_scan_max_meters_);
+		  }
+		  this->mbus_scan_next(false, now_);
+		  break;
+	  }
+	  this->mbus_record_phase(MBUS_PHASE_DATA, now_);
+	  this->mbus_history_.push(this->telegram, this->mbus_telegram_len_, now_);
+	  this->mbus_fingerprint_frame();
+	  //frame already decoded while receiving, committing its records right away,
+	  //so that the buffer can take the next frame of a multi-telegram readout
+	  if(this->mbus_finish_frame()) this->mbus_frame_count_++;
+	  if(this->mbus_more_frames_){
+		  if(this->mbus_frame_count_ < mbus_max_frames_){
+			  //toggling FCB requests the next frame instead of a repetition
+			  this->mbus_request_frame_[1] ^= mbus_control_fcb_;
+			  this->mbus_request_frame_[3] = this->mbus_request_frame_[1] + this->mbus_request_frame_[2];
+			  MBUS_LOGD(TAG, " %s: sending REQUEST DATA command for frame %d", this->mbus_address_str_, this->mbus_frame_count_ + 1);
+			  this->write_array(this->mbus_request_frame_, mbus_request_frame_len_);
+			  this->mbus_timer_ = now_;
+			  this->mbus_phase_start_ = now_;
+			  this->mbus_rx_started_ = false;
+			  this->mbus_state_ = MBUS_STATE_AWAIT_HEADER;
+			  break;
+		  }
+		  ESP_LOGW(TAG, " %s: More than %d frames, some data may be unavailable.", this->mbus_address_str_, mbus_max_frames_);
+	  }
+	  //readout done, switching meter back to base rate first
+	  if(this->mbus_baud_switched_){
+		  this->mbus_baud_return_state_ = MBUS_STATE_READOUT_DONE;
+		  this->mbus_state_ = MBUS_STATE_BAUD_RESTORE;
+		  break;
+	  }
+	  this->mbus_state_ = MBUS_STATE_READOUT_DONE;
+	  break;
+	  
+	  //releasing uart
+	  case MBUS_STATE_READOUT_DONE:
 	  this->mbus_state_ = MBUS_STATE_IDLE;
-	  this->telegram_count++;
+	  this->mbus_release_bus(true, now_);
+	  this->mbus_set_suspended(false);
+	  this->mbus_failures_ = 0;
+	  this->mbus_backoff_ = 0;
+	  //signalling to sensors that there are new data records to look up,
+	  //unless the meter sent the same as last time
+	  if(this->mbus_frame_count_){
+		  this->mbus_record_phase(MBUS_PHASE_TRANSACTION, now_);
+		  if(this->mbus_frame_count_ != this->mbus_fingerprint_count_) this->mbus_readout_changed_ = true;
+		  this->mbus_fingerprint_count_ = this->mbus_frame_count_;
+		  bool heartbeat = this->mbus_heartbeat_ && (now_ - this->mbus_last_callback_ >= this->mbus_heartbeat_);
+		  if(!this->mbus_readout_changed_ && !heartbeat){
+			  MBUS_LOGD(TAG, " %s: Readout unchanged", this->mbus_address_str_);
+			  this->mbus_stats_.unchanged_readouts++;
+		  } else {
+			  this->mbus_last_callback_ = now_;
+			  this->telegram_count++;
+			  this->telegram_callback_.call(heartbeat);
+		  }
+	  }
+	  this->mbus_trace(true, now_);
 	  break;
 	  
+	  //letting the rest of a garbled response pass: retrying once the bus has been quiet
+	  //for as long as the meter takes to answer, or after a frame of maximum length
 	  case MBUS_STATE_RETRY_WAIT:
-	  if(now_ > this->mbus_timer_ + this->mbus_timeout_long_){
+	  if(this->mbus_rx_available()){
+		  this->mbus_rx_purge();
+		  this->mbus_timer_ = this->mbus_rx_last_at(now_);
+	  }
+	  if( (now_ - this->mbus_timer_ > ack_timeout_) || (now_ - this->mbus_wait_start_ > this->mbus_timeout_long_) ){
 		  this->mbus_state_ = MBUS_STATE_RETRY;
 	  }
 	  break;
 	  
 	  case MBUS_STATE_RETRY:
+	  //during bus scan, a garbled response after select means more than one meter answered
+	  if(this->mbus_scanning_){
+		  this->mbus_scan_next(true, now_);
+		  break;
+	  }
+	  //failed at higher baud rate: switching back and retrying at base rate
+	  if(this->mbus_baud_switched_){
+		  this->mbus_baud_fallback_ = true;
+		  this->mbus_baud_return_state_ = MBUS_STATE_RETRY;
+		  this->mbus_state_ = MBUS_STATE_BAUD_RESTORE;
+		  break;
+	  }
 	  this->mbus_retry_count_ --;
+	  this->mbus_selection_sent_ = false;
 	  if(this->mbus_retry_count_) {
-		  this->mbus_state_ = MBUS_STATE_BUS_RESET_PRE;
-		  ESP_LOGD(TAG, " %llx: retrying", this->secondary_address);
+		  this->mbus_stats_.retries++;
+		  this->mbus_state_ = this->mbus_primary_addressing_ ? MBUS_STATE_REQUEST_DATA : MBUS_STATE_BUS_RESET_PRE;
+		  MBUS_LOGD(TAG, " %s: retrying", this->mbus_address_str_);
 		  break;
 	  }
-	  ESP_LOGE(TAG, " %llx: Retries exhausted, aborting.", this->secondary_address);
-	  mbus_uart_locked_ = false;
+	  ESP_LOGE(TAG, " %s: Retries exhausted, aborting.", this->mbus_address_str_);
+	  this->mbus_stats_.failed_transactions++;
+	  //records of the frames received so far are committed but not passed on, so the next readout must be
+	  this->mbus_fingerprint_count_ = 0;
 	  this->mbus_state_ = MBUS_STATE_IDLE;
+	  //a failed probe only selected a meter that does not answer, the sweep goes on
+	  this->mbus_release_bus(this->mbus_suspended_, now_);
+	  this->mbus_transaction_failed(now_);
+	  this->mbus_trace(false, now_);
 	  break;
 	  
+	  //bus scan: select next address of the wildcard tree
+	  case MBUS_STATE_SCAN_PROBE:
+	  this->mbus_rx_purge();
+	  MBUS_LOGD(TAG, " %s: Scan: probing %016" PRIX64, this->mbus_address_str_, this->mbus_scan_probe_address());
+	  this->mbus_build_select_frame(this->mbus_scan_probe_address());
+	  this->write_array(this->mbus_select_frame_, mbus_select_frame_len_);
+	  this->mbus_timer_ = now_;
+	  this->mbus_state_ = MBUS_STATE_AWAIT_SELSCT_SA;
+	  break;
+	  
+	  //meter acknowledges the switch at the old rate, then both change
+	  case MBUS_STATE_AWAIT_BAUD_ACK:
+	  if(this->mbus_baud_switched_){
+		  //giving the meter time to change its rate
+		  if(now_ - this->mbus_timer_ < ack_timeout_) break;
+		  this->mbus_state_ = MBUS_STATE_REQUEST_DATA;
+		  break;
+	  }
+	  if(!this->mbus_rx_available()){
+		  if(now_ - this->mbus_timer_ < ack_timeout_) break;
+		  ESP_LOGW(TAG, " %s: Baud rate switch not acknowledged, reading at %d baud", this->mbus_address_str_, this->mbus_base_baud_rate_);
+		  this->mbus_baud_failures_++;
+		  //not taken by the meter, so neither is its FCB
+		  this->mbus_request_frame_[1] ^= mbus_control_fcb_;
+		  this->mbus_request_frame_[3] = this->mbus_request_frame_[1] + this->mbus_request_frame_[2];
+		  this->mbus_baud_fallback_ = true;
+		  this->mbus_state_ = MBUS_STATE_REQUEST_DATA;
+		  break;
+	  }
+	  this->mbus_rx_read(this->telegram, 1);
+	  if( this->telegram[0] != mbus_ack_ ){
+		  ESP_LOGW(TAG, " %s: Invalid answer to baud rate switch, reading at %d baud", this->mbus_address_str_, this->mbus_base_baud_rate_);
+		  this->mbus_baud_failures_++;
+		  this->mbus_baud_fallback_ = true;
+		  this->mbus_state_ = MBUS_STATE_REQUEST_DATA;
+		  break;
+	  }
+	  MBUS_LOGD(TAG, " %s: switching to %d baud", this->mbus_address_str_, this->mbus_max_baud_rate_);
+	  this->mbus_baud_failures_ = 0;
+	  this->mbus_set_baud_rate(this->mbus_max_baud_rate_);
+	  this->mbus_baud_switched_ = true;
+	  this->mbus_timer_ = now_;
+	  break;
+	  
+	  case MBUS_STATE_BAUD_RESTORE:
+	  MBUS_LOGD(TAG, " %s: sending SWITCH BAUDRATE command, %d baud", this->mbus_address_str_, this->mbus_base_baud_rate_);
+	  this->mbus_rx_purge();
+	  this->mbus_request_frame_[1] ^= mbus_control_fcb_;
+	  this->mbus_request_frame_[3] = this->mbus_request_frame_[1] + this->mbus_request_frame_[2];
+	  this->mbus_send_baud_switch(this->mbus_base_baud_rate_);
+	  this->mbus_timer_ = now_;
+	  this->mbus_state_ = MBUS_STATE_AWAIT_BAUD_RESTORE;
+	  break;
+	  
+	  //switching uart back in any case: the meter falls back to its base rate on its own after a while
+	  case MBUS_STATE_AWAIT_BAUD_RESTORE:
+	  if(!this->mbus_rx_available() && (now_ - this->mbus_timer_ < ack_timeout_)) break;
+	  if(!this->mbus_rx_available() || !this->mbus_rx_read(this->telegram, 1) || (this->telegram[0] != mbus_ack_)){
+		  ESP_LOGW(TAG, " %s: Switch back to %d baud not acknowledged", this->mbus_address_str_, this->mbus_base_baud_rate_);
+	  }
+	  MBUS_LOGD(TAG, " %s: switching to %d baud", this->mbus_address_str_, this->mbus_base_baud_rate_);
+	  this->mbus_set_baud_rate(this->mbus_base_baud_rate_);
+	  this->mbus_baud_switched_ = false;
+	  this->mbus_state_ = this->mbus_baud_return_state_;
+	  break;
+	  
+	  //meter acknowledges the selection, or does not support it: then reading out all records
+	  case MBUS_STATE_AWAIT_SELECTION_ACK:
+	  if(!this->mbus_rx_available() && (now_ - this->mbus_timer_ < ack_timeout_)) break;
+	  if(!this->mbus_rx_available() || !this->mbus_rx_read(this->telegram, 1) || (this->telegram[0] != mbus_ack_)){
+		  ESP_LOGW(TAG, " %s: Selective readout not acknowledged, reading out all records", this->mbus_address_str_);
+		  if(++this->mbus_selection_failures_ >= mbus_max_retries_){
+			  ESP_LOGW(TAG, " %s: Meter does not support selective readout", this->mbus_address_str_);
+		  }
+		  //not taken by the meter, so neither is its FCB
+		  this->mbus_request_frame_[1] ^= mbus_control_fcb_;
+		  this->mbus_request_frame_[3] = this->mbus_request_frame_[1] + this->mbus_request_frame_[2];
+	  } else {
+		  this->mbus_selection_failures_ = 0;
+	  }
+	  this->mbus_selection_sent_ = true;
+	  this->mbus_state_ = MBUS_STATE_REQUEST_DATA;
+	  break;
 	  
 	  } //end switch
+	  
+  //nothing left to do, stop running until next update
+  if( (this->mbus_state_ == MBUS_STATE_IDLE) && !this->mbus_update_due_ && !this->mbus_scan_due_ ){
+	  this->mbus_running_ = false;
+  }
 }
 
 void Mbus::update() {
- ESP_LOGD(TAG, "update(): %llx, locked: %s", this->secondary_address, YESNO(mbus_uart_locked_));
+ uint32_t now_ = this->mbus_clock_();
+ MBUS_LOGD(TAG, "update(): %s, locked: %s", this->mbus_address_str_, YESNO(this->mbus_bus_->owner));
+ this->mbus_poll(now_);
+ //meters following this one in its sweep
+ for(Mbus* meter = this->mbus_bus_->meters; meter; meter = meter->mbus_bus_next_){
+	 if(meter->mbus_sweep_leader_ == this) meter->mbus_poll(now_);
+ }
+}
+
+/* void Mbus::mbus_poll(uint32_t now):
+ * 
+ * Start a readout of this meter, or coalesce the poll with the one still
+ * pending.
+ * */
+void Mbus::mbus_poll(uint32_t now_) {
+ //suspended meter, backing off: not even probed
+ if( this->mbus_suspended_ && ( (int32_t) (now_ - this->mbus_resume_at_) < 0 ) ){
+	 MBUS_LOGD(TAG, " %s: suspended, skipping poll", this->mbus_address_str_);
+	 return;
+ }
+ //previous readout not done yet: deadline missed, polls are coalesced
+ if( this->mbus_update_due_ || ( (this->mbus_state_ != MBUS_STATE_IDLE) && !this->mbus_scanning_ ) ){
+	 ESP_LOGW(TAG, " %s: Readout not done within update interval", this->mbus_address_str_);
+	 this->mbus_stats_.missed_deadlines++;
+ }
+ //a readout still waiting for the bus serves this poll as well, and keeps its deadline,
+ //or a meter kept waiting would never become overdue
+ if( (this->mbus_state_ == MBUS_STATE_AWAIT_LOCK) && !this->mbus_scanning_ ) return;
+ if(!this->mbus_update_due_) this->mbus_deadline_ = now_ + this->get_update_interval();
  this->mbus_update_due_ = true;
+ this->mbus_start();
+}
+
+void Mbus::scan() {
+ if(!this->mbus_scan_bus_) return;
+ this->mbus_scan_due_ = true;
+ this->mbus_deadline_ = this->mbus_clock_();
+ this->mbus_start();
+}
+
+/* log data as hex, in lines of mbus_hex_line_bytes_
+ * */
+void Mbus::mbus_log_hex(const uint8_t* data, uint16_t len) {
+  char line[3 * mbus_hex_line_bytes_ + 1];
+  for(uint16_t pos=0; pos<len; pos+=mbus_hex_line_bytes_){
+    uint8_t n = ( len - pos < mbus_hex_line_bytes_ ) ? len - pos : mbus_hex_line_bytes_;
+    mbus_format_hex(line, &data[pos], n, false);
+    ESP_LOGI(TAG, "   %s", line);
+  }
+}
+
+void Mbus::dump_history() {
+  struct MbusTelegramRef ref;
+  uint32_t now_ = this->mbus_clock_();
+  
+  ESP_LOGI(TAG, " %s: %d frames in history", this->mbus_address_str_, this->mbus_history_.size());
+  for(uint16_t i=0; this->mbus_history_.get(i, &ref); i++){
+    ESP_LOGI(TAG, " %s: frame %d, received %u ms ago, %d bytes", this->mbus_address_str_, i, now_ - ref.timestamp, ref.len);
+    this->mbus_log_hex(ref.data, ref.len);
+  }
 }
 
 void Mbus::dump_config() {
   ESP_LOGCONFIG(TAG, "Mbus:");
-  ESP_LOGCONFIG(TAG, "  Secondary address: %llX", this->secondary_address);
+  if(this->mbus_primary_addressing_) {
+    ESP_LOGCONFIG(TAG, "  Primary address: %d", this->primary_address);
+  } else {
+    ESP_LOGCONFIG(TAG, "  Secondary address: %" PRIX64, this->secondary_address);
+  }
+  if(this->mbus_max_baud_rate_ > this->mbus_base_baud_rate_) {
+    ESP_LOGCONFIG(TAG, "  Max baud rate: %d", this->mbus_max_baud_rate_);
+  }
+  ESP_LOGCONFIG(TAG, "  Timeouts: %u ms (ACK), %u ms (response), learned down to %u ms", this->mbus_timeout_short_,
+    this->mbus_timeout_long_, this->mbus_timeout_floor_);
+  uint8_t meters = 0;
+  for(Mbus* meter = this->mbus_bus_->meters; meter; meter = meter->mbus_bus_next_) meters++;
+  ESP_LOGCONFIG(TAG, "  Meters on this bus: %d", meters);
+#ifdef MBUS_RX_TASK
+  if(this->mbus_bus_->rx) {
+    ESP_LOGCONFIG(TAG, "  RX task: running, %u bytes dropped", this->mbus_bus_->rx->overruns.load());
+  }
+#endif
+  ESP_LOGCONFIG(TAG, "  Priority: %d", this->mbus_priority_);
+  if(this->mbus_max_bus_utilization_ < 100.0f) {
+    ESP_LOGCONFIG(TAG, "  Max bus utilization: %.0f%%", this->mbus_max_bus_utilization_);
+  }
+  if(this->mbus_update_offset_) {
+    ESP_LOGCONFIG(TAG, "  Update offset: %u ms", this->mbus_update_offset_);
+  }
+  if(this->mbus_sweep_leader_) {
+    ESP_LOGCONFIG(TAG, "  Polled along with: %s", this->mbus_sweep_leader_->get_address_str());
+  }
+  
+  const struct MbusStats* stats = &(this->mbus_stats_);
+  ESP_LOGCONFIG(TAG, "  Transactions: %u, failed: %u, retries: %u", stats->transactions, stats->failed_transactions, stats->retries);
+  ESP_LOGCONFIG(TAG, "  Timeouts: %u ACK, %u header, %u data", stats->ack_timeouts, stats->header_timeouts, stats->data_timeouts);
+  ESP_LOGCONFIG(TAG, "  Collisions: %u, invalid headers: %u, checksum errors: %u", stats->collisions, stats->invalid_headers,
+    stats->checksum_errors);
+  ESP_LOGCONFIG(TAG, "  Bytes received: %u, unchanged readouts: %u", stats->bytes_received, stats->unchanged_readouts);
+  ESP_LOGCONFIG(TAG, "  Missed deadlines: %u, bus utilization: %.1f%%", stats->missed_deadlines, this->mbus_bus_->utilization);
+  ESP_LOGCONFIG(TAG, "  Suspensions: %u%s", stats->suspensions, this->mbus_suspended_ ? ", suspended now" : "");
+#ifdef USE_BINARY_SENSOR
+  LOG_BINARY_SENSOR("  ", "Suspended", this->suspended_binary_sensor_);
+#endif
+  static const char *const phase_names[MBUS_PHASE_COUNT] = {"Reset", "Select", "Header", "Data", "Transaction"};
+  for(uint8_t i=0; i<MBUS_PHASE_COUNT; i++){
+    const struct MbusPhaseStats* phase = &(stats->phases[i]);
+    if(!phase->count) continue;
+    //histogram buckets: < 16, < 32, < 64, < 128, < 256, < 512, < 1024, >= 1024 ms
+    ESP_LOGCONFIG(TAG, "  %s latency: last %u ms, avg %u ms, max %u ms, histogram %u %u %u %u %u %u %u %u", phase_names[i],
+      phase->last_ms, phase->sum_ms / phase->count, phase->max_ms, phase->histogram[0], phase->histogram[1],
+      phase->histogram[2], phase->histogram[3], phase->histogram[4], phase->histogram[5], phase->histogram[6],
+      phase->histogram[7]);
+  }
+  if(this->mbus_aes_.has_key()) {
+    ESP_LOGCONFIG(TAG, "  Decryption: AES-128-CBC");
+  }
+  if(this->mbus_selection_frame_) {
+    ESP_LOGCONFIG(TAG, "  Selective readout: %d records", this->record_count_);
+  }
+  if(this->mbus_history_.capacity()) {
+    ESP_LOGCONFIG(TAG, "  Telegram history: %d bytes, %d frames", this->mbus_history_.capacity(), this->mbus_history_.size());
+  }
+  if(this->mbus_scan_bus_) {
+    ESP_LOGCONFIG(TAG, "  Bus scan: %d meters, cache holds %d", this->mbus_scan_result_->count, this->mbus_scan_cache_size_);
+    for(uint8_t i=0; i<this->mbus_scan_result_->count; i++){
+      ESP_LOGCONFIG(TAG, "    %016" PRIX64, this->mbus_scan_result_->addresses[i]);
+    }
+  }
   
 }
 
@@ -1,26 +1,172 @@
 #pragma once
 
 #include "esphome/core/component.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/preferences.h"
 #include "esphome/components/uart/uart.h"
+#ifdef USE_BINARY_SENSOR
+#include "esphome/components/binary_sensor/binary_sensor.h"
+#endif
+#include "mbus_datarecord.h"
+#include "mbus_history.h"
+#include "mbus_aes.h"
 
 namespace esphome {
 namespace mbus {
 	
 static const uint8_t mbus_max_retries_ = 3;
+static const uint8_t mbus_max_frames_ = 16; //per multi-telegram readout
+static const uint32_t mbus_tick_ms_ = 10; //state machine period while a transaction is pending
+static const uint32_t mbus_utilization_window_ms_ = 60000;
+static const uint8_t mbus_suspend_failures_ = 3; //failed transactions in a row until the meter is suspended
+static const uint32_t mbus_backoff_max_ms_ = 3600000; //longest time between probes of a suspended meter
 
-static const unsigned char* mbus_reset_frame_ = (const unsigned char*)"\x10\x40\xFD\x3D\x16";
+static const uint16_t mbus_frame_max_len_ = 261; //long frame with 252 bytes of user data
+static const uint32_t mbus_timeout_floor_ms_ = 50; //EN 13757-2 allows 330 bit times + 50 ms to respond
+static const uint32_t mbus_timeout_margin_ms_ = 2 * mbus_tick_ms_; //state machine sees bytes up to one tick late
+
+static const uint16_t mbus_rx_queue_len_ = 1024; //RX task: bytes buffered per bus, power of two
+static const uint16_t mbus_rx_chunk_len_ = 64; //RX task: bytes moved from the uart at once
+static const uint32_t mbus_rx_task_stack_ = 2048;
+static const uint8_t mbus_rx_task_priority_ = 5; //above the main loop task
+
+static const unsigned char* const mbus_reset_frame_ = (const unsigned char*)"\x10\x40\xFD\x3D\x16";
 static const size_t mbus_reset_frame_len_ = 5;
 
-static const unsigned char* mbus_request_frame_ = (const unsigned char*)"\x10\x5B\xFD\x58\x16";
+static const unsigned char* const mbus_request_frame_raw_ = (const unsigned char*)"\x10\x5B\xFD\x58\x16";
 static const size_t mbus_request_frame_len_ = 5;
 
-static const unsigned char* mbus_select_frame_raw_ = 
+static const unsigned char* const mbus_select_frame_raw_ = 
 	(const unsigned char*)"\x68\x0B\x0B\x68\x73\xFD\x52\x00\x00\x00\x00\x00\x00\x00\x00\x00\x16";
 static const size_t mbus_select_frame_len_ = 17;
 
+static const unsigned char* const mbus_baud_frame_raw_ = (const unsigned char*)"\x68\x03\x03\x68\x53\xFD\xBB\x00\x16";
+static const size_t mbus_baud_frame_len_ = 9;
+static const uint8_t mbus_ci_baud_300_ = 0xB8; //0xB8 + n switches to 300 << n baud, up to 0xBF (38400)
+static const uint32_t mbus_baud_min_ = 300;
+static const uint32_t mbus_baud_max_ = 38400;
+
+static const uint8_t mbus_control_snd_ud_ = 0x53;
+static const uint8_t mbus_ci_select_records_ = 0x51; //SND_UD with DIF/VIF templates of the records to read out
+static const uint8_t mbus_dif_selection_ = 0x08; //data field "selection for readout"
+
+static const uint8_t mbus_address_network_layer_ = 0xFD;
+static const uint8_t mbus_control_fcb_ = 0x20;
+
 static const uint8_t mbus_ack_ = 0xE5;
 static const uint8_t mbus_long_frame_ = 0x68;
+static const uint8_t mbus_hex_line_bytes_ = 32; //bytes per line when logging frames as hex
+static const uint8_t mbus_security_mode_aes_cbc_ = 5; //configuration field, EN 13757-7
+static const uint8_t mbus_encryption_check_ = 0x2F; //first two bytes of a decrypted payload
 
+static const uint8_t mbus_scan_max_meters_ = 64;
+static const uint8_t mbus_scan_cache_page_meters_ = 16; //meters per preference of a cached scan result
+static const uint8_t mbus_scan_cache_pages_ = mbus_scan_max_meters_ / mbus_scan_cache_page_meters_;
+static const uint8_t mbus_scan_cache_headers_ = 4; //distinct manufacturer, version and medium in a cached scan result
+
+/* Secondary addresses of the meters found by the last bus scan.
+ * */
+struct MbusScanResult {
+  uint8_t count;
+  uint64_t addresses[mbus_scan_max_meters_];
+};
+
+/* Scan result as persisted to flash: the manufacturer, version and medium
+ * (lower 32 bits of the secondary address) the meters have, then in pages
+ * of mbus_scan_cache_page_meters_ the ID of each meter and an index into
+ * them, each in a preference of its own. Only the pages for scan_cache_size
+ * meters are made, so on the ESP8266 the cache takes the flash it needs.
+ * Results with more meters, or more distinct headers, are not cached.
+ * */
+struct MbusScanCache {
+  uint8_t count;
+  uint8_t header_count;
+  uint32_t headers[mbus_scan_cache_headers_];
+};
+struct MbusScanCachePage {
+  uint8_t header_index[mbus_scan_cache_page_meters_];
+  uint32_t ids[mbus_scan_cache_page_meters_];
+};
+
+struct MbusBus;
+
+static const uint8_t mbus_stats_buckets_ = 8; //latency histogram: < 16 ms, < 32 ms, ..., < 1024 ms, more
+
+enum MbusPhase : uint8_t {
+	MBUS_PHASE_RESET, //bus resets until select sent
+	MBUS_PHASE_SELECT, //select sent until ACK without collision
+	MBUS_PHASE_HEADER, //request sent until header received
+	MBUS_PHASE_DATA, //header received until frame complete
+	MBUS_PHASE_TRANSACTION, //lock acquired until readout complete
+	MBUS_PHASE_COUNT,
+};
+
+struct MbusPhaseStats {
+  uint32_t last_ms;
+  uint32_t max_ms;
+  uint32_t sum_ms;
+  uint32_t count;
+  uint32_t histogram[mbus_stats_buckets_];
+};
+
+/* Counters kept per Mbus instance since boot (not during bus scan).
+ * */
+struct MbusStats {
+  uint32_t transactions;
+  uint32_t failed_transactions; //retries exhausted
+  uint32_t retries;
+  uint32_t ack_timeouts;
+  uint32_t header_timeouts;
+  uint32_t data_timeouts;
+  uint32_t collisions;
+  uint32_t invalid_headers;
+  uint32_t checksum_errors;
+  uint32_t bytes_received;
+  uint32_t unchanged_readouts; //not passed on to sensors
+  uint32_t missed_deadlines; //readout not done within update_interval
+  uint32_t suspensions; //meter stopped responding
+  struct MbusPhaseStats phases[MBUS_PHASE_COUNT];
+};
+
+enum MbusStatistic : uint8_t {
+	MBUS_STATISTIC_TRANSACTIONS,
+	MBUS_STATISTIC_FAILED_TRANSACTIONS,
+	MBUS_STATISTIC_RETRIES,
+	MBUS_STATISTIC_ACK_TIMEOUTS,
+	MBUS_STATISTIC_HEADER_TIMEOUTS,
+	MBUS_STATISTIC_DATA_TIMEOUTS,
+	MBUS_STATISTIC_COLLISIONS,
+	MBUS_STATISTIC_INVALID_HEADERS,
+	MBUS_STATISTIC_CHECKSUM_ERRORS,
+	MBUS_STATISTIC_BYTES_RECEIVED,
+	MBUS_STATISTIC_UNCHANGED_READOUTS,
+	MBUS_STATISTIC_MISSED_DEADLINES,
+	MBUS_STATISTIC_SUSPENSIONS,
+	MBUS_STATISTIC_BUS_UTILIZATION, //percentage of time the bus was in use, over the last minute
+	MBUS_STATISTIC_RESET_LATENCY, //average of all observations, in ms
+	MBUS_STATISTIC_SELECT_LATENCY,
+	MBUS_STATISTIC_HEADER_LATENCY,
+	MBUS_STATISTIC_DATA_LATENCY,
+	MBUS_STATISTIC_TRANSACTION_LATENCY,
+};
+
+/* Smoothed latency of a meter in 1/8 ms, with smoothed mean deviation in
+ * 1/4 ms, as in Jacobson's RTT estimator. samples is 0 until the first
+ * latency has been observed (or after a timeout), the static worst case
+ * timeouts are used then.
+ * */
+struct MbusLatency {
+  uint32_t srtt8;
+  uint32_t rttvar4;
+  uint8_t samples;
+};
+
+enum MbusHeaderState : uint8_t {
+	MBUS_HEADER_PENDING,
+	MBUS_HEADER_OK,
+	MBUS_HEADER_INVALID,
+};
 
 enum MbusState {
 	MBUS_STATE_IDLE,
@@ -30,10 +176,18 @@ enum MbusState {
 	MBUS_STATE_BUS_RESET_2,
 	MBUS_STATE_AWAIT_SELSCT_SA,
 	MBUS_STATE_AWAIT_SELSCT_SA_2,
+	MBUS_STATE_REQUEST_DATA,
 	MBUS_STATE_AWAIT_HEADER,
 	MBUS_STATE_AWAIT_DATA,
 	MBUS_STATE_RETRY_WAIT,
 	MBUS_STATE_RETRY,
+	MBUS_STATE_SCAN_PROBE,
+	MBUS_STATE_AWAIT_BAUD_ACK,
+	MBUS_STATE_BAUD_RESTORE,
+	MBUS_STATE_AWAIT_BAUD_RESTORE,
+	MBUS_STATE_READOUT_DONE,
+	MBUS_STATE_AWAIT_SELECTION_ACK,
+	MBUS_STATE_SELECT,
 }; 
 	
 class Mbus : public uart::UARTDevice, public PollingComponent {
@@ -41,17 +195,97 @@ class Mbus : public uart::UARTDevice, public PollingComponent {
 
   void setup() override;
 
-  void loop() override;
-
   void dump_config() override;
   
   void update() override;
 
   float get_setup_priority() const override;
   
-  void set_secondary_address(uint64_t secondary_address) { this->secondary_address = secondary_address; }
+  void set_secondary_address(uint64_t secondary_address) {
+    this->secondary_address = secondary_address;
+    this->mbus_format_address();
+  }
+  
+  void set_primary_address(uint8_t primary_address) {
+    this->primary_address = primary_address;
+    this->mbus_primary_addressing_ = true;
+    this->mbus_format_address();
+  }
+  
+  //address the meter is read at, as prefixed to log messages
+  const char* get_address_str() const { return this->mbus_address_str_; }
+  
+  //negotiate this rate with the meter for the readout, if higher than the uart's
+  void set_max_baud_rate(uint32_t max_baud_rate) { this->mbus_max_baud_rate_ = max_baud_rate; }
+  
+  //enumerate all meters on the uart if there is no cached scan result
+  void set_scan_bus(const std::string &cache_key);
+  //meters the cached scan result holds, up to mbus_scan_max_meters_
+  void set_scan_cache_size(uint8_t meters) { this->mbus_scan_cache_size_ = (meters < mbus_scan_max_meters_) ? meters : mbus_scan_max_meters_; }
+  //rescan the bus, even if there is a cached scan result
+  void scan();
+  const struct MbusScanResult* get_scan_result() const { return this->mbus_scan_result_; }
+  
+  uint64_t secondary_address{0xFFFFFFFFFFFFFFFF};
+  uint8_t primary_address{mbus_address_network_layer_};
+  
+  //decrypt security mode 5 telegrams with this key, 32 hex digits
+  void set_aes_key(const std::string &key);
+  
+  //among meters waiting for the bus, higher priority is read first, unless others are overdue
+  void set_priority(int8_t priority) { this->mbus_priority_ = priority; }
+  //poll at this offset from setup plus multiples of update_interval, to stagger meters on a bus
+  void set_update_offset(uint32_t offset) { this->mbus_update_offset_ = offset; }
+  //percentage, the lowest of the meters on a bus applies to the bus
+  void set_max_bus_utilization(float percent) { this->mbus_max_bus_utilization_ = percent; }
+  
+  //access number of the first frame of the last readout
+  uint8_t get_access_number() const { return this->mbus_access_numbers_[0]; }
+  
+  //whether the meter stopped responding and is only probed now and then
+  bool is_suspended() const { return this->mbus_suspended_; }
+#ifdef USE_BINARY_SENSOR
+  void set_suspended_binary_sensor(binary_sensor::BinarySensor* sensor) { this->suspended_binary_sensor_ = sensor; }
+#endif
+  
+  //ask the meter to send only the records sensors use
+  void set_selective_readout(bool selective_readout) { this->mbus_selective_readout_ = selective_readout; }
+  
+  //keep the last frames received in a buffer of this many bytes
+  void set_history_size(uint16_t size) { this->mbus_history_.allocate(size); }
+  //frames can be read in place, until the next frame is received
+  const MbusTelegramHistory* get_history() const { return &(this->mbus_history_); }
+  //log all frames in the history as hex
+  void dump_history();
+  
+  //sorted key table and result slots generated by the sensor platform
+  void set_record_table(const struct MbusRecordKey* keys, struct MbusRecordSlot* slots, uint16_t count) {
+    this->record_keys_ = keys;
+    this->record_slots_ = slots;
+    this->record_count_ = count;
+  }
+  //result of the most recent telegram, valid once telegram_count changes
+  const struct MbusRecordSlot* get_record_slot(uint16_t index) const { return &(this->record_slots_[index]); }
+  const struct MbusStats* get_stats() const { return &(this->mbus_stats_); }
+  //value of a single counter, or average latency of a phase; NAN if never observed
+  float get_statistic(enum MbusStatistic statistic) const;
+  /* called whenever a readout completes and telegram_count changes, which is
+   * only if any frame differs from the previous readout, or heartbeat is due
+   * (then the argument is true, asking to publish unchanged values as well) */
+  void add_on_telegram_callback(std::function<void(bool)> &&callback) { this->telegram_callback_.add(std::move(callback)); }
+  //pass on unchanged readouts at least this often, 0 never
+  void set_heartbeat(uint32_t heartbeat) { this->mbus_heartbeat_ = heartbeat; }
+  //log a one-line summary of a transaction at most this often, 0 never
+  void set_trace_interval(uint32_t interval) { this->mbus_trace_interval_ = interval; }
+  //add the frames of the traced transaction from the history as hex
+  void set_trace_hexdump(bool hexdump) { this->mbus_trace_hexdump_ = hexdump; }
   
-  uint64_t secondary_address;
+  /* read the time (ms) from clock instead of millis(), everywhere: for driving the
+   * instance on simulated time, along with a scheduler running on the same clock */
+  void set_clock(uint32_t (*clock)()) { this->mbus_clock_ = clock; }
+  uint32_t get_time() const { return this->mbus_clock_(); }
+  //run one tick of the state machine, as the scheduler does every mbus_tick_ms_ while a transaction is in progress
+  void tick() { this->mbus_statemachine(this->mbus_clock_()); }
   
   uint8_t telegram[270];
   uint8_t telegram_count;
@@ -59,16 +293,129 @@ class Mbus : public uart::UARTDevice, public PollingComponent {
  protected:
  
  
+ uint32_t (*mbus_clock_)(){millis};
+ struct MbusBus* mbus_bus_;
+ Mbus* mbus_bus_next_{nullptr}; //next meter on the same bus
+ Mbus* mbus_sweep_leader_{nullptr}; //meter on the same bus that polls this one along with it
+ bool mbus_skip_reset_; //bus already reset in this sweep
+ int8_t mbus_priority_{0};
+ float mbus_max_bus_utilization_{100.0f};
+ uint32_t mbus_deadline_; //of the pending poll: when the next one is due
+ uint32_t mbus_update_offset_{0};
+ uint32_t mbus_next_poll_; //with update_offset
+ uint8_t mbus_failures_{0}; //failed transactions in a row
+ bool mbus_suspended_{false};
+ uint32_t mbus_backoff_{0};
+ uint32_t mbus_resume_at_; //next probe of a suspended meter
+#ifdef USE_BINARY_SENSOR
+ binary_sensor::BinarySensor* suspended_binary_sensor_{nullptr};
+#endif
  uint32_t mbus_timeout_short_;
  uint32_t mbus_timeout_long_;
+ uint32_t mbus_timeout_floor_;
+ struct MbusLatency mbus_ack_latency_{};
+ struct MbusLatency mbus_response_latency_{};
  uint32_t mbus_timer_;
+ uint32_t mbus_wait_start_;
  enum MbusState mbus_state_;
  uint8_t mbus_retry_count_;
  bool mbus_update_due_;
+ bool mbus_running_{false}; //the "mbus" interval runs the state machine
  uint16_t mbus_telegram_len_;
+ uint16_t mbus_rx_pos_;
+ bool mbus_rx_started_;
+ uint8_t mbus_rx_checksum_;
+ enum MbusHeaderState mbus_header_state_;
+ uint16_t mbus_decode_pos_;
+ enum MbusPayloadStatus mbus_payload_status_;
+ uint8_t mbus_frame_record_count_;
+ uint8_t mbus_frame_count_;
+ bool mbus_more_frames_;
+ bool mbus_primary_addressing_{false};
+ char mbus_address_str_[17]{"ffffffffffffffff"};
+ uint32_t mbus_base_baud_rate_;
+ uint32_t mbus_max_baud_rate_{0};
+ bool mbus_baud_switched_{false};
+ bool mbus_baud_fallback_; //stay at base rate for the rest of the transaction
+ uint8_t mbus_baud_failures_{0};
+ enum MbusState mbus_baud_return_state_;
+ bool mbus_selective_readout_{false};
+ uint8_t* mbus_selection_frame_{nullptr}; //built once from the record table
+ uint16_t mbus_selection_frame_len_{0};
+ bool mbus_selection_sent_; //for this readout
+ uint8_t mbus_selection_failures_{0};
+ MbusAes mbus_aes_;
+ uint16_t mbus_encrypted_len_; //of the frame being received, 0 once decrypted
  uint8_t mbus_select_frame_[mbus_select_frame_len_];
+ uint8_t mbus_request_frame_[mbus_request_frame_len_];
+ bool mbus_scan_bus_{false};
+ bool mbus_scan_due_{false};
+ bool mbus_scanning_{false};
+ uint32_t mbus_scan_cache_hash_;
+ uint8_t mbus_scan_depth_;
+ uint8_t mbus_scan_digit_[8];
+ struct MbusScanResult* mbus_scan_result_{nullptr}; //only allocated if scanning is enabled
+ uint8_t mbus_scan_cache_size_{mbus_scan_max_meters_}; //meters the cached scan result holds
+ ESPPreferenceObject mbus_scan_pref_;
+ ESPPreferenceObject mbus_scan_pages_[mbus_scan_cache_pages_];
+ const struct MbusRecordKey* record_keys_{nullptr};
+ struct MbusRecordSlot* record_slots_{nullptr};
+ uint16_t record_count_{0};
+ CallbackManager<void(bool)> telegram_callback_;
+ struct MbusStats mbus_stats_{};
+ MbusTelegramHistory mbus_history_;
+ uint32_t mbus_heartbeat_{0};
+ uint32_t mbus_last_callback_;
+ uint32_t mbus_fingerprints_[mbus_max_frames_]; //hash of each frame of the previous readout
+ uint8_t mbus_access_numbers_[mbus_max_frames_];
+ uint8_t mbus_fingerprint_count_{0}; //number of frames of the previous readout
+ bool mbus_readout_changed_;
+ uint32_t mbus_phase_start_;
+ uint32_t mbus_trace_interval_{0};
+ bool mbus_trace_hexdump_{false};
+ uint32_t mbus_last_trace_;
+ uint32_t mbus_traces_skipped_{0};
+ uint32_t mbus_trace_phase_ms_[MBUS_PHASE_COUNT]; //of the current transaction, summed over retries
+ uint32_t mbus_transaction_start_;
   
+  void mbus_format_address();
+  void mbus_start();
+  bool mbus_poll_before(const Mbus* other, uint32_t now) const;
+  Mbus* mbus_bus_pick(uint32_t now) const;
+  void mbus_release_bus(bool clean, uint32_t now);
+  void mbus_transaction_failed(uint32_t now);
+  void mbus_set_suspended(bool suspended);
+  void mbus_tick();
+  void mbus_poll(uint32_t now);
+  void mbus_record_phase(enum MbusPhase phase, uint32_t now);
+  void mbus_trace(bool success, uint32_t now);
+  void mbus_log_hex(const uint8_t* data, uint16_t len);
+  void mbus_statemachine(uint32_t now_);
   uint8_t mbus_checksum(const uint8_t* data);
+  void mbus_set_timeouts(uint32_t baud_rate);
+  void mbus_set_baud_rate(uint32_t baud_rate);
+  uint16_t mbus_rx_available();
+  bool mbus_rx_read(uint8_t* data, uint16_t len);
+  void mbus_rx_purge();
+  uint32_t mbus_rx_first_at(uint32_t now);
+  uint32_t mbus_rx_last_at(uint32_t now);
+  bool mbus_baud_negotiate();
+  void mbus_send_baud_switch(uint32_t baud_rate);
+  void mbus_build_selection_frame();
+  bool mbus_selection_pending();
+  void mbus_learn_latency(struct MbusLatency* latency, uint32_t sample);
+  uint32_t mbus_learned_timeout(const struct MbusLatency* latency, uint32_t ceiling);
+  bool mbus_parse_header();
+  bool mbus_decrypt_frame();
+  void mbus_decode_frame();
+  bool mbus_finish_frame();
+  void mbus_fingerprint_frame();
+  void mbus_build_select_frame(uint64_t address);
+  uint64_t mbus_select_address();
+  uint64_t mbus_scan_probe_address();
+  void mbus_scan_next(bool collision, uint32_t now_);
+  void mbus_scan_save();
+  bool mbus_scan_load();
 
   
 };
@@ -0,0 +1,36 @@
+#include "mbus_aes.h"
+
+namespace esphome {
+namespace mbus {
+
+bool MbusAes::set_key(const uint8_t* key) {
+#if defined(USE_ESP32)
+	mbedtls_aes_init(&(this->ctx_));
+	this->has_key_ = !mbedtls_aes_setkey_dec(&(this->ctx_), key, 128);
+#elif defined(USE_ESP8266)
+	br_aes_big_cbcdec_init(&(this->ctx_), key, MBUS_AES_BLOCK_LEN);
+	this->has_key_ = true;
+#else
+	(void) key;
+	this->has_key_ = false;
+#endif
+	return this->has_key_;
+}
+
+bool MbusAes::decrypt_cbc(uint8_t* iv, uint8_t* data, uint16_t len) {
+	if( !this->has_key_ || (len % MBUS_AES_BLOCK_LEN) ) return false;
+#if defined(USE_ESP32)
+	//mbedtls keeps a copy of each ciphertext block, so input and output may be the same buffer
+	return !mbedtls_aes_crypt_cbc(&(this->ctx_), MBEDTLS_AES_DECRYPT, len, iv, data, data);
+#elif defined(USE_ESP8266)
+	br_aes_big_cbcdec_run(&(this->ctx_), iv, data, len);
+	return true;
+#else
+	(void) iv;
+	(void) data;
+	return false;
+#endif
+}
+
+}  // namespace mbus
+}  // namespace esphome
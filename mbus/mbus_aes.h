@@ -0,0 +1,41 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+
+#include <cstdint>
+
+#if defined(USE_ESP32)
+#include <mbedtls/aes.h>
+#elif defined(USE_ESP8266)
+#include <bearssl/bearssl_block.h>
+#endif
+
+namespace esphome {
+namespace mbus {
+
+static const uint8_t MBUS_AES_BLOCK_LEN = 16;
+
+/* AES-128-CBC decryption for security mode 5 telegrams, using the
+ * platform's crypto library: mbedtls on ESP32 (hardware AES where the chip
+ * and sdkconfig provide it), BearSSL on ESP8266. The key schedule is
+ * computed once, when the key is set.
+ * */
+class MbusAes {
+ public:
+  //false if the platform has no AES implementation
+  bool set_key(const uint8_t* key);
+  bool has_key() const { return this->has_key_; }
+  //decrypt len bytes (a multiple of MBUS_AES_BLOCK_LEN) in place, iv is overwritten
+  bool decrypt_cbc(uint8_t* iv, uint8_t* data, uint16_t len);
+
+ protected:
+  bool has_key_{false};
+#if defined(USE_ESP32)
+  mbedtls_aes_context ctx_;
+#elif defined(USE_ESP8266)
+  br_aes_big_cbcdec_keys ctx_;
+#endif
+};
+
+}  // namespace mbus
+}  // namespace esphome
@@ -0,0 +1,397 @@
+#include "mbus_datarecord.h"
+
+#include "esphome/core/log.h"
+#include "mbus_log.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+
+namespace esphome {
+namespace mbus {
+	
+static const char *const TAG = "mbus.datarecord";
+
+//data field length by datatype, MBUS_VARIABLE_LEN is handled separately
+static const uint8_t MBUS_DATA_LEN[16] = { 0, 1, 2, 3, 4, 4, 6, 8, 0, 1, 2, 3, 4, 0, 6, 0 };
+
+const char* MbusDIFDatatypeToStr(enum MbusDIFDatatype datatype){
+  switch (datatype){
+  case MBUS_NO_DATA: return "MBUS_NO_DATA"; break;
+  case MBUS_INT_8BIT: return "MBUS_INT_8BIT"; break;
+  case MBUS_INT_16BIT: return "MBUS_INT_16BIT"; break;
+  case MBUS_INT_24BIT: return "MBUS_INT_24BIT"; break;
+  case MBUS_INT_32BIT: return "MBUS_INT_32BIT"; break;
+  case MBUS_INT_48BIT: return "MBUS_INT_48BIT"; break;
+  case MBUS_INT_64BIT: return "MBUS_INT_64BIT"; break;
+  case MBUS_REAL: return "MBUS_REAL"; break;
+  case MBUS_SELECTION: return "MBUS_SELECTION"; break;
+  case MBUS_BCD2: return "MBUS_BCD2"; break;
+  case MBUS_BCD4: return "MBUS_BCD4"; break;
+  case MBUS_BCD6: return "MBUS_BCD6"; break;
+  case MBUS_BCD8: return "MBUS_BCD8"; break;
+  case MBUS_VARIABLE_LEN: return "MBUS_VARIABLE_LEN"; break;
+  case MBUS_BCD12: return "MBUS_BCD12"; break;
+  case MBUS_SPECIAL: return "MBUS_SPECIAL"; break;
+  default: return "Unknown"; break;
+  }
+}
+
+const char* MbusDIFFunctionToStr(enum MbusDIFFunction function){
+  switch (function){
+  case MBUS_INSTANT_VALUE: return "MBUS_INSTANT_VALUE"; break;
+  case MBUS_MAXIMUM_VALUE: return "MBUS_MAXIMUM_VALUE"; break;
+  case MBUS_MINIMUM_VALUE: return "MBUS_MINIMUM_VALUE"; break;
+  case MBUS_ERROR_VALUE: return "MBUS_ERROR_VALUE"; break;
+  default: return "Unknown"; break;
+ }
+}
+
+/* number of data bytes following the LVAR byte of variable length data
+ * */
+static uint8_t MbusLvarLength(uint8_t lvar){
+	if(lvar <= MBUS_LVAR_TEXT_MAX) return lvar;
+	return lvar & 0x0F;
+}
+
+/* signed binary integer (type B) of len bytes, least significant byte first
+ * */
+static int64_t MbusDecodeInteger(const uint8_t* data, uint8_t len){
+	uint64_t result = 0;
+	for(uint8_t i=len; i>0; i--) result = (result << 8) | data[i-1];
+	//sign extension
+	if( (len < 8) && (data[len-1] & 0x80) ) result |= ~(uint64_t) 0 << (len * 8);
+	return (int64_t) result;
+}
+
+/* BCD (type A) of len bytes, least significant byte first. A most significant
+ * digit of F denotes a negative value.
+ * */
+static int64_t MbusDecodeBCD(const uint8_t* data, uint8_t len, bool negative){
+	int64_t result = 0;
+	for(uint8_t i=len; i>0; i--){
+		uint8_t high = data[i-1] >> 4;
+		if( (i == len) && (high == 0x0F) ){
+			negative = true;
+			high = 0;
+		}
+		result = result * 100 + high * 10 + (data[i-1] & 0x0F);
+	}
+	return negative ? -result : result;
+}
+
+/* bool MbusDecodeVariableLength(const uint8_t* data, union MbusValue* value, const char* address):
+ * 
+ * Decode variable length data, data pointing at the LVAR byte. Numeric
+ * forms are decoded to integer, text is logged.
+ * 
+ * Returns false if there is no numeric value.
+ * */
+static bool MbusDecodeVariableLength(const uint8_t* data, union MbusValue* value, const char* address){
+	uint8_t lvar = data[0];
+	if(lvar <= MBUS_LVAR_TEXT_MAX){
+#if MBUS_LOG_DETAIL
+		//text is sent last character first
+		char text[MBUS_LVAR_TEXT_MAX + 1];
+		for(uint8_t i=0; i<lvar; i++) text[i] = data[lvar-i];
+		text[lvar] = 0;
+		MBUS_LOGD(TAG, " %s: VARIABLE LENGTH text: %s", address, text);
+#endif
+		return false;
+	}
+	if( (lvar < MBUS_LVAR_BINARY) && ( (lvar & 0x0F) <= 9 ) ){
+		value->integer = MbusDecodeBCD(&data[1], lvar & 0x0F, lvar >= MBUS_LVAR_BCD_NEGATIVE);
+		return true;
+	}
+	if( (lvar >= MBUS_LVAR_BINARY) && (lvar < MBUS_LVAR_FLOAT) && (lvar & 0x0F) && ( (lvar & 0x0F) <= 8 ) ){
+		value->integer = MbusDecodeInteger(&data[1], lvar & 0x0F);
+		return true;
+	}
+	ESP_LOGW(TAG, " %s: VARIABLE LENGTH type 0x%02X, decoding not supported.", address, lvar);
+	return false;
+}
+
+/* uint16_t MbusDataRecordLength(const uint8_t* tg, uint16_t avail):
+ * 
+ * Determine the length of a variable-length Data Record from its first
+ * avail bytes, without decoding it.
+ * 
+ * tg: pointer to the Data Record's DIF
+ * avail: number of bytes available starting at tg
+ * 
+ * Returns 0 if more bytes are needed, otherwise the number of bytes
+ * MbusParseDataRecord() will consume (or examine before failing).
+ * */
+uint16_t MbusDataRecordLength(const uint8_t* tg, uint16_t avail){
+	uint16_t pos = 0;
+	if(pos >= avail) return 0;
+	bool extension_flag = tg[pos] & MBUS_DIF_EXTENSION_MASK;
+	uint8_t datatype = tg[pos] & MBUS_DIF_DATATYPE_MASK;
+	pos++;
+	
+	uint8_t dife_count = 0;
+	while(extension_flag){
+		if(++dife_count > MBUS_DIFE_MAX) return pos;
+		if(pos >= avail) return 0;
+		extension_flag = tg[pos] & MBUS_DIFE_EXTENSION_MASK;
+		pos++;
+	}
+	
+	uint8_t vife_count = 0;
+	extension_flag = true;
+	while(extension_flag){
+		if(++vife_count > MBUS_VIFE_MAX) return pos;
+		if(pos >= avail) return 0;
+		extension_flag = tg[pos] & MBUS_VIFE_EXTENSION_MASK;
+		pos++;
+	}
+	
+	if(datatype == MBUS_VARIABLE_LEN){
+		if(pos >= avail) return 0;
+		pos += 1 + MbusLvarLength(tg[pos]);
+	} else {
+		pos += MBUS_DATA_LEN[datatype];
+	}
+	
+	if(pos > avail) return 0;
+	return pos;
+}
+
+/* uint8_t MbusParseDataRecord(const uint8_t* tg, MbusDataRecord* record, const char* address):
+ * 
+ * Parse a variable-length Data Record into its attributes and unscaled value.
+ * 
+ * tg: pointer to the Data Record's DIF
+ * record: parse result, valid only if nonzero is returned
+ * address: of the meter, as formatted for log messages only
+ * 
+ * Returns 0 on error, length of parsed data otherwise.
+ * 
+ * On error, logs error message.
+ * */
+
+uint8_t MbusParseDataRecord(const uint8_t* tg, struct MbusDataRecord* record, const char* address){
+	
+	uint8_t pos = 0;
+	
+	uint64_t storage = 0;
+	uint32_t tariff = 0;
+	uint16_t subunit = 0;
+	enum MbusDIFFunction function;
+	enum MbusDIFDatatype datatype;
+	
+	//DIF
+	bool extension_flag = false;
+	if(tg[pos] & MBUS_DIF_EXTENSION_MASK) extension_flag = true;
+	function = (MbusDIFFunction) (tg[pos] & MBUS_DIF_FUNCTION_MASK);
+	datatype = (MbusDIFDatatype) (tg[pos] & MBUS_DIF_DATATYPE_MASK);
+	if(tg[pos] & MBUS_DIF_STORAGE_MASK) storage = 1;
+	pos++;
+	
+	//DIFE
+	uint8_t dife_count = 0;
+	while(extension_flag){
+		dife_count++;
+		if(dife_count > MBUS_DIFE_MAX){
+			ESP_LOGE(TAG, " %s: Too many DIFE fields", address);
+			return 0;
+		}
+		extension_flag = tg[pos] & MBUS_DIFE_EXTENSION_MASK;
+		tariff += ( ( tg[pos] & MBUS_DIFE_TARIFF_MASK ) >> 4 ) << ( (dife_count-1) * 2 );
+		subunit += ( ( tg[pos] & MBUS_DIFE_SUBUNIT_MASK ) >> 6 ) << (dife_count-1);
+		storage += (uint64_t) ( tg[pos] & MBUS_DIFE_STORAGE_MASK ) << ( ( (dife_count-1) * 4) + 1 );
+		pos++;
+	}
+
+	//VIF + VIFE
+	
+	/* Due to the complexities involved with multiple coexisting VIF+VIFE schemes and
+	 * their possible future extensions, the approach taken is to represent VIF
+	 * and the first 7 VIFEs as a single 64-bit integer and ignore the rest. */
+	
+	uint64_t vif_vife = 0;
+	extension_flag = true;
+	uint8_t vife_count = 0;
+	
+	while(extension_flag){
+		vife_count++;
+		if(vife_count > MBUS_VIFE_MAX){
+			ESP_LOGW(TAG, " %s: Too many VIFE fields.", address);
+			return 0;
+		}
+		if(vife_count > 8){
+			ESP_LOGW(TAG, " %s: Too many VIFE fields, ignoring.", address);
+		} else {
+			vif_vife = vif_vife << 8;
+			vif_vife |= (uint64_t) tg[pos];
+		}
+		extension_flag = tg[pos] & MBUS_VIFE_EXTENSION_MASK;
+		pos++;
+	}
+	
+	//Datatype-dependent value parsing
+	
+	union MbusValue value;
+	value.integer = 0;
+	bool has_value = true;
+
+	switch (datatype){
+		
+	default: 
+		ESP_LOGE(TAG, " %s: Unknown datatype %d", address, datatype);
+		return 0;
+
+	case MBUS_NO_DATA:
+	case MBUS_SELECTION:
+		has_value = false;
+		break;
+	
+	case MBUS_SPECIAL:
+		ESP_LOGE(TAG, " %s: Unexpected SPECIAL FUNCTION datatype %d", address, datatype);
+		return 0;
+	
+	case MBUS_VARIABLE_LEN:
+		has_value = MbusDecodeVariableLength(&tg[pos], &value, address);
+		pos += 1 + MbusLvarLength(tg[pos]);
+		break;
+		
+	case MBUS_REAL: {
+		//IEEE 754 single precision, least significant byte first
+		uint32_t bits = (uint32_t) tg[pos] | ( (uint32_t) tg[pos+1] << 8 ) | ( (uint32_t) tg[pos+2] << 16 ) | ( (uint32_t) tg[pos+3] << 24 );
+		float real;
+		memcpy(&real, &bits, sizeof(real));
+		value.real = real;
+		pos += 4;
+		break;
+	}
+	
+	case MBUS_INT_8BIT:
+	case MBUS_INT_16BIT:
+	case MBUS_INT_24BIT:
+	case MBUS_INT_32BIT:
+	case MBUS_INT_48BIT:
+	case MBUS_INT_64BIT:
+		value.integer = MbusDecodeInteger(&tg[pos], MBUS_DATA_LEN[datatype]);
+		pos += MBUS_DATA_LEN[datatype];
+		break;
+	
+	case MBUS_BCD2:
+	case MBUS_BCD4:
+	case MBUS_BCD6:
+	case MBUS_BCD8:
+	case MBUS_BCD12:
+		value.integer = MbusDecodeBCD(&tg[pos], MBUS_DATA_LEN[datatype], false);
+		pos += MBUS_DATA_LEN[datatype];
+		break;
+		
+	}
+
+	if(!has_value){
+		MBUS_LOGD(TAG, " %s: function: %s, datatype: %s, storage: %" PRIu64 ", tariff: %d, subunit: %d, VIF(E): 0x%" PRIX64 ", no value", address,
+		MbusDIFFunctionToStr(function), MbusDIFDatatypeToStr(datatype),  storage, tariff, subunit, vif_vife);
+	} else if(datatype == MBUS_REAL){
+		MBUS_LOGD(TAG, " %s: function: %s, datatype: %s, storage: %" PRIu64 ", tariff: %d, subunit: %d, VIF(E): 0x%" PRIX64 ", value: %g", address,
+		MbusDIFFunctionToStr(function), MbusDIFDatatypeToStr(datatype),  storage, tariff, subunit, vif_vife, value.real);
+	} else {
+		MBUS_LOGD(TAG, " %s: function: %s, datatype: %s, storage: %" PRIu64 ", tariff: %d, subunit: %d, VIF(E): 0x%" PRIX64 ", value: %" PRId64, address,
+		MbusDIFFunctionToStr(function), MbusDIFDatatypeToStr(datatype),  storage, tariff, subunit, vif_vife, value.integer);
+	}
+	
+	record->storage = storage;
+	record->vif_vife = vif_vife;
+	record->value = value;
+	record->has_value = has_value;
+	record->tariff = tariff;
+	record->subunit = subunit;
+	record->function = function;
+	record->datatype = datatype;
+	
+	return pos;
+}
+
+/* struct MbusRecordSlot* MbusFindRecordSlot(const struct MbusDataRecord* record,
+ *   const struct MbusRecordKey* keys, struct MbusRecordSlot* slots, uint16_t count):
+ * 
+ * Look up the key of a decoded Data Record in a sorted key table.
+ * 
+ * Returns the result slot of the matching key, nullptr if not found.
+ * */
+struct MbusRecordSlot* MbusFindRecordSlot(const struct MbusDataRecord* record,
+  const struct MbusRecordKey* keys, struct MbusRecordSlot* slots, uint16_t count){
+	const struct MbusRecordKey key = { record->vif_vife, record->storage,
+		MbusPackRecordAttributes(record->tariff, record->subunit, record->function) };
+	const struct MbusRecordKey* found = std::lower_bound(keys, keys + count, key);
+	if( (found == keys + count) || !(*found == key) ) return nullptr;
+	return &slots[found - keys];
+}
+
+/* enum MbusPayloadStatus MbusParseVariablePayload(const uint8_t* tg, uint16_t* pos, uint16_t avail, uint16_t end,
+ *   const struct MbusRecordKey* keys, struct MbusRecordSlot* slots, uint16_t count,
+ *   uint8_t* record_count, const char* address):
+ * 
+ * Decode the variable-length Data Records of a telegram that is still being
+ * received, as far as they are complete, and put the value of each record
+ * found in the sorted key table in the pending fields of its result slot.
+ * Called again as more bytes arrive, it continues where it left off.
+ * 
+ * Depends on nothing but the telegram buffer and the tables, so it can be
+ * driven without a bus or an Mbus instance.
+ * 
+ * tg: telegram buffer
+ * pos: index of the DIF of the next Data Record, advanced past decoded records
+ * avail: number of bytes of tg received so far
+ * end: index of the last byte of the variable payload
+ * record_count: incremented for each Data Record decoded
+ * 
+ * Returns MBUS_PAYLOAD_INCOMPLETE if more bytes are needed, MBUS_PAYLOAD_ERROR
+ * on error, MBUS_PAYLOAD_DONE otherwise, with pos at the manufacturer-specific
+ * DIF (or at end + 1 if there is none).
+ * */
+enum MbusPayloadStatus MbusParseVariablePayload(const uint8_t* tg, uint16_t* pos, uint16_t avail, uint16_t end,
+  const struct MbusRecordKey* keys, struct MbusRecordSlot* slots, uint16_t count,
+  uint8_t* record_count, const char* address){
+	
+	if(avail > end + 1) avail = end + 1;
+	
+	while( *pos <= end )
+	{ //each iteration of the while loop processes one Data Record,
+		//beginning with pos pointing at DIF. Iteration ends with
+		//pos pointing at DIF of next Data Record.
+		
+		if(*pos >= avail) return MBUS_PAYLOAD_INCOMPLETE;
+		
+		if( ( tg[*pos] == MBUS_DIF_MANUFACTURER_SPECIFIC ) ||
+			( tg[*pos] == MBUS_DIF_MANUFACTURER_SPECIFIC_MULTIFRAME ) ) break;
+		
+		if(tg[*pos] == MBUS_DIF_FILLER) {
+			(*pos)++;
+			continue;
+		}
+		
+		if(!MbusDataRecordLength(&tg[*pos], avail - *pos)) {
+			if(avail <= end) return MBUS_PAYLOAD_INCOMPLETE;
+			ESP_LOGW(TAG, " %s: Overrun while parsing telegram.", address);
+			return MBUS_PAYLOAD_ERROR;
+		}
+		
+		struct MbusDataRecord record;
+		uint8_t ret = MbusParseDataRecord(&tg[*pos], &record, address);
+		if(!ret) return MBUS_PAYLOAD_ERROR; //error logging is done in MbusParseDataRecord
+		(*record_count)++;
+		*pos += ret;
+		
+		struct MbusRecordSlot* slot = MbusFindRecordSlot(&record, keys, slots, count);
+		if(slot) {
+			MBUS_LOGD(TAG, " %s: Match", address);
+			slot->pending_value = record.value;
+			slot->pending_datatype = record.datatype;
+			slot->pending_has_value = record.has_value;
+			slot->pending_count++;
+		}
+	} //end while
+	
+	return MBUS_PAYLOAD_DONE;
+}
+	
+}  // namespace mbus
+}  // namespace esphome
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <cstdint>
+
+namespace esphome {
+namespace mbus {
+
+	//fixed data header-specific definitions
+static const uint8_t MBUS_CONTROL_RSP_UD = 0X08;
+static const uint8_t MBUS_CI_RESP_VARIABLE = 0x72;
+static const uint8_t MBUS_STATUS_APP_ERROR = 0x03;
+static const uint8_t MBUS_STATUS_LOW_POWER = 0x04;
+static const uint8_t MBUS_STATUS_PERMANENT_ERROR = 0x08;
+static const uint8_t MBUS_STATUS_TEMPORARY_ERROR = 0x10;
+static const uint8_t MBUS_DIF_MANUFACTURER_SPECIFIC = 0x0F;
+static const uint8_t MBUS_DIF_MANUFACTURER_SPECIFIC_MULTIFRAME = 0x1F;
+static const uint8_t MBUS_DIF_FILLER = 0x2F;
+
+	//variable-length Data Record-specific definitions
+static const uint8_t MBUS_DIF_DATATYPE_MASK = 0x0F;
+static const uint8_t MBUS_DIF_FUNCTION_MASK = 0x30;
+static const uint8_t MBUS_DIF_STORAGE_MASK = 0x40;
+static const uint8_t MBUS_DIF_EXTENSION_MASK = 0x80;
+
+static const uint8_t MBUS_DIFE_MAX = 10;
+static const uint8_t MBUS_DIFE_EXTENSION_MASK = 0X80;
+static const uint8_t MBUS_DIFE_SUBUNIT_MASK = 0X40;
+static const uint8_t MBUS_DIFE_TARIFF_MASK = 0X30;
+static const uint8_t MBUS_DIFE_STORAGE_MASK = 0X0F;
+
+static const uint8_t MBUS_VIFE_MAX = 11; //VIF + 10 VIFEs
+static const uint8_t MBUS_VIFE_EXTENSION_MASK = 0X80;
+
+	//variable length data (LVAR), EN 13757-3 table 5
+static const uint8_t MBUS_LVAR_TEXT_MAX = 0xBF;
+static const uint8_t MBUS_LVAR_BCD_POSITIVE = 0xC0;
+static const uint8_t MBUS_LVAR_BCD_NEGATIVE = 0xD0;
+static const uint8_t MBUS_LVAR_BINARY = 0xE0;
+static const uint8_t MBUS_LVAR_FLOAT = 0xF0;
+
+	//VIF scaling, EN 13757-3 table 10
+static const int8_t MBUS_VIF_NO_SCALE = -128; //VIF/VIFE carries no decimal scale known to MbusVIFExponent()
+
+enum MbusDIFDatatype : uint8_t {
+  MBUS_NO_DATA = 0X00,
+  MBUS_INT_8BIT = 0X01,
+  MBUS_INT_16BIT = 0X02,
+  MBUS_INT_24BIT = 0X03,
+  MBUS_INT_32BIT = 0X04,
+  MBUS_INT_48BIT = 0X06,
+  MBUS_INT_64BIT = 0X07,
+  MBUS_REAL = 0X05,
+  MBUS_SELECTION = 0X08,
+  MBUS_BCD2 = 0X09,
+  MBUS_BCD4 = 0X0A,
+  MBUS_BCD6 = 0X0B,
+  MBUS_BCD8 = 0X0C,
+  MBUS_VARIABLE_LEN = 0X0D,
+  MBUS_BCD12 = 0X0E,
+  MBUS_SPECIAL = 0X0F,
+};
+
+enum MbusDIFFunction : uint8_t {
+  MBUS_INSTANT_VALUE = 0X00,
+  MBUS_MAXIMUM_VALUE = 0X10,
+  MBUS_MINIMUM_VALUE = 0X20,
+  MBUS_ERROR_VALUE = 0X30,
+};
+
+/* Value of a Data Record exactly as sent by the meter, without any VIF-dependent
+ * scaling: real for MBUS_REAL, integer (signed, binary or BCD-decoded) otherwise.
+ * */
+union MbusValue {
+  int64_t integer;
+  double real;
+};
+
+/* A single decoded variable-length Data Record.
+ *
+ * Records of MBUS_NO_DATA, MBUS_SELECTION and non-numeric MBUS_VARIABLE_LEN
+ * data (text) carry no value; numeric MBUS_VARIABLE_LEN data is decoded to
+ * integer.
+ * */
+struct MbusDataRecord {
+  uint64_t storage;
+  uint64_t vif_vife;
+  union MbusValue value;
+  bool has_value;
+  uint32_t tariff;
+  uint16_t subunit;
+  enum MbusDIFFunction function;
+  enum MbusDIFDatatype datatype;
+};
+
+/* Fixed-width key identifying a Data Record, as generated for each sensor
+ * by mbus/sensor/__init__.py. Tariff (20 bits), subunit (10 bits) and
+ * function (2 bits) are packed into attributes. Tables of keys are kept
+ * sorted by (vif_vife, storage, attributes) so they can be binary searched.
+ * */
+struct MbusRecordKey {
+  uint64_t vif_vife;
+  uint64_t storage;
+  uint32_t attributes;
+};
+
+inline constexpr uint32_t MbusPackRecordAttributes(uint32_t tariff, uint16_t subunit, enum MbusDIFFunction function) {
+  return ( tariff & 0xFFFFF ) | ( (uint32_t) ( subunit & 0x3FF ) << 20 ) | ( (uint32_t) ( function >> 4 ) << 30 );
+}
+
+inline constexpr bool operator<(const struct MbusRecordKey &a, const struct MbusRecordKey &b) {
+  return (a.vif_vife != b.vif_vife) ? (a.vif_vife < b.vif_vife) :
+         (a.storage != b.storage) ? (a.storage < b.storage) :
+         (a.attributes < b.attributes);
+}
+
+inline constexpr bool operator==(const struct MbusRecordKey &a, const struct MbusRecordKey &b) {
+  return (a.vif_vife == b.vif_vife) && (a.storage == b.storage) && (a.attributes == b.attributes);
+}
+
+/* Per-key result of the most recent telegram. match_count other than 1
+ * means the record was missing from, or ambiguous in, the telegram.
+ * 
+ * Records are decoded while the frame is still being received, so they
+ * go to the pending_ fields first and are only committed once the
+ * checksum of the frame has been verified.
+ * */
+struct MbusRecordSlot {
+  union MbusValue value;
+  union MbusValue pending_value;
+  enum MbusDIFDatatype datatype;
+  enum MbusDIFDatatype pending_datatype;
+  bool has_value;
+  bool pending_has_value;
+  uint8_t match_count;
+  uint8_t pending_count;
+};
+
+enum MbusPayloadStatus : uint8_t {
+  MBUS_PAYLOAD_INCOMPLETE, //more bytes needed to decode the next Data Record
+  MBUS_PAYLOAD_DONE,
+  MBUS_PAYLOAD_ERROR,
+};
+
+/* constexpr int8_t MbusVIFExponent(uint64_t vif_vife):
+ * 
+ * Decimal exponent of the unit the primary VIF of a VIF/VIFE chain (as
+ * packed by MbusParseDataRecord()) states its value in, including a
+ * multiplicative correction VIFE (0x70 to 0x77) following it. Units are
+ * those listed in README.md (e.g. kWh for energy sent in Wh): the value in
+ * that unit is value * 10^exponent.
+ * 
+ * Returns MBUS_VIF_NO_SCALE for extension tables, manufacturer-specific
+ * VIFs, dates and other values without a decimal scale.
+ * */
+inline constexpr int8_t MbusVIFExponent(uint64_t vif_vife) {
+  //the VIF is the most significant nonzero byte (a lone VIF 0x00 packs to 0)
+  uint8_t shift = 56;
+  while( shift && !( (vif_vife >> shift) & 0xFF ) ) shift -= 8;
+  const uint8_t vif = (vif_vife >> shift) & 0x7F;
+  int8_t correction = 0;
+  if(shift){
+    //only a single multiplicative correction factor VIFE is understood, others change the meaning
+    const uint8_t vife = (vif_vife >> (shift - 8)) & 0xFF;
+    if( ( (vife & 0x78) != 0x70 ) || ( (shift > 8) && (vife & MBUS_VIFE_EXTENSION_MASK) ) ) return MBUS_VIF_NO_SCALE;
+    correction = (int8_t) (vife & 0x07) - 6;
+  }
+  const int8_t n3 = vif & 0x07;
+  const int8_t n2 = vif & 0x03;
+  return
+    (vif <= 0x07) ? (int8_t) (n3 - 6 + correction) : //energy, Wh -> kWh
+    (vif <= 0x0F) ? (int8_t) (n3 - 6 + correction) : //energy, J -> MJ
+    (vif <= 0x17) ? (int8_t) (n3 - 6 + correction) : //volume, m3
+    (vif <= 0x1F) ? (int8_t) (n3 - 3 + correction) : //mass, kg
+    (vif <= 0x27) ? correction :                     //on time and operating time, s/min/h/d
+    (vif <= 0x2F) ? (int8_t) (n3 - 3 + correction) : //power, W
+    (vif <= 0x37) ? (int8_t) (n3 - 3 + correction) : //power, J/h -> kJ/h
+    (vif <= 0x3F) ? (int8_t) (n3 - 6 + correction) : //volume flow, m3/h
+    (vif <= 0x47) ? (int8_t) (n3 - 7 + correction) : //volume flow, m3/min
+    (vif <= 0x4F) ? (int8_t) (n3 - 9 + correction) : //volume flow, m3/s
+    (vif <= 0x57) ? (int8_t) (n3 - 3 + correction) : //mass flow, kg/h
+    (vif <= 0x67) ? (int8_t) (n2 - 3 + correction) : //flow, return, difference, external temperature, C or K
+    (vif <= 0x6B) ? (int8_t) (n2 - 3 + correction) : //pressure, bar
+    (vif <= 0x6D) ? MBUS_VIF_NO_SCALE :              //date, date and time
+    (vif == 0x6E) ? correction :                     //units for heat cost allocator
+    (vif == 0x6F) ? MBUS_VIF_NO_SCALE :
+    (vif <= 0x77) ? correction :                     //averaging and actuality duration, s/min/h/d
+    MBUS_VIF_NO_SCALE;                               //identification, address, extension tables, manufacturer specific
+}
+
+/* Scale a value by 10^exponent. Dividing by 10^-exponent rather than multiplying
+ * by its inverse keeps e.g. 1234 * 10^-3 exactly 1.234.
+ * */
+inline double MbusScaleValue(double value, int8_t exponent) {
+  static constexpr double pow10[16] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+    1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15 };
+  if( (exponent == MBUS_VIF_NO_SCALE) || !exponent ) return value;
+  if(exponent > 0) return value * pow10[exponent & 0x0F];
+  return value / pow10[(-exponent) & 0x0F];
+}
+
+const char* MbusDIFDatatypeToStr(enum MbusDIFDatatype datatype);
+const char* MbusDIFFunctionToStr(enum MbusDIFFunction function);
+
+uint16_t MbusDataRecordLength(const uint8_t* tg, uint16_t avail);
+uint8_t MbusParseDataRecord(const uint8_t* tg, struct MbusDataRecord* record, const char* address);
+struct MbusRecordSlot* MbusFindRecordSlot(const struct MbusDataRecord* record,
+  const struct MbusRecordKey* keys, struct MbusRecordSlot* slots, uint16_t count);
+enum MbusPayloadStatus MbusParseVariablePayload(const uint8_t* tg, uint16_t* pos, uint16_t avail, uint16_t end,
+  const struct MbusRecordKey* keys, struct MbusRecordSlot* slots, uint16_t count,
+  uint8_t* record_count, const char* address);
+
+}  // namespace mbus
+}  // namespace esphome
@@ -0,0 +1,94 @@
+#include "mbus_history.h"
+
+#include <cstring>
+
+namespace esphome {
+namespace mbus {
+
+void MbusTelegramHistory::allocate(uint16_t size) {
+	delete[] this->buffer_;
+	this->buffer_ = size ? new uint8_t[size] : nullptr;
+	this->capacity_ = size;
+	this->head_ = this->tail_ = this->newest_ = this->end_ = this->count_ = 0;
+	this->wrapped_ = false;
+}
+
+uint16_t MbusTelegramHistory::frame_len(uint16_t pos) const {
+	uint16_t len;
+	memcpy(&len, &(this->buffer_[pos + 4]), sizeof(len));
+	return len;
+}
+
+/* position of the frame following the one at pos
+ * */
+uint16_t MbusTelegramHistory::next(uint16_t pos) const {
+	pos += header_len_ + this->frame_len(pos);
+	if(this->wrapped_ && (pos >= this->end_)) pos = 0;
+	return pos;
+}
+
+void MbusTelegramHistory::read(uint16_t pos, struct MbusTelegramRef* ref) const {
+	memcpy(&(ref->timestamp), &(this->buffer_[pos]), sizeof(ref->timestamp));
+	ref->len = this->frame_len(pos);
+	ref->data = &(this->buffer_[pos + header_len_]);
+}
+
+void MbusTelegramHistory::drop_oldest() {
+	uint16_t pos = this->head_ + header_len_ + this->frame_len(this->head_);
+	this->count_--;
+	if(this->wrapped_ && (pos >= this->end_)){
+		pos = 0;
+		this->wrapped_ = false;
+	}
+	this->head_ = pos;
+}
+
+/* void MbusTelegramHistory::push(const uint8_t* frame, uint16_t len, uint32_t timestamp):
+ * 
+ * Copy a frame into the history, dropping as many of the oldest frames as
+ * needed to make room. Frames larger than the whole buffer are not stored.
+ * */
+void MbusTelegramHistory::push(const uint8_t* frame, uint16_t len, uint32_t timestamp) {
+	uint32_t need = header_len_ + len;
+	if(need > this->capacity_) return;
+	
+	for(;;){
+		if(!this->count_){
+			this->head_ = this->tail_ = 0;
+			this->wrapped_ = false;
+		}
+		if(!this->wrapped_){
+			if(this->tail_ + need <= this->capacity_) break;
+			//no room at the top, continuing at the bottom
+			this->end_ = this->tail_;
+			this->tail_ = 0;
+			this->wrapped_ = true;
+		}
+		if(this->tail_ + need <= this->head_) break;
+		this->drop_oldest();
+	}
+	
+	memcpy(&(this->buffer_[this->tail_]), &timestamp, sizeof(timestamp));
+	memcpy(&(this->buffer_[this->tail_ + 4]), &len, sizeof(len));
+	memcpy(&(this->buffer_[this->tail_ + header_len_]), frame, len);
+	this->newest_ = this->tail_;
+	this->tail_ += need;
+	this->count_++;
+}
+
+bool MbusTelegramHistory::get(uint16_t index, struct MbusTelegramRef* ref) const {
+	if(index >= this->count_) return false;
+	uint16_t pos = this->head_;
+	while(index--) pos = this->next(pos);
+	this->read(pos, ref);
+	return true;
+}
+
+bool MbusTelegramHistory::get_newest(struct MbusTelegramRef* ref) const {
+	if(!this->count_) return false;
+	this->read(this->newest_, ref);
+	return true;
+}
+
+}  // namespace mbus
+}  // namespace esphome
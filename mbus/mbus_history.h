@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace mbus {
+
+/* A stored frame, pointing into the history buffer. Valid until the next
+ * frame is added to the history.
+ * */
+struct MbusTelegramRef {
+  const uint8_t* data;
+  uint16_t len;
+  uint32_t timestamp; //millis() when received
+};
+
+/* History of the last raw frames received from a meter.
+ * 
+ * Frames are kept back to back in a single buffer allocated once, each
+ * preceded by a 6 byte header (timestamp, length), so a frame only takes up
+ * as much space as it is long. A frame never wraps around the end of the
+ * buffer, so it can be read in place. When the buffer is full, the oldest
+ * frames are dropped.
+ * */
+class MbusTelegramHistory {
+ public:
+  //allocate size bytes, 0 disables the history
+  void allocate(uint16_t size);
+  void push(const uint8_t* frame, uint16_t len, uint32_t timestamp);
+  
+  uint16_t size() const { return this->count_; }
+  uint16_t capacity() const { return this->capacity_; }
+  //index 0 is the oldest frame, size() - 1 the newest; false if there is no such frame
+  bool get(uint16_t index, struct MbusTelegramRef* ref) const;
+  bool get_newest(struct MbusTelegramRef* ref) const;
+
+ protected:
+  static const uint16_t header_len_ = 6;
+  
+  uint16_t frame_len(uint16_t pos) const;
+  uint16_t next(uint16_t pos) const;
+  void read(uint16_t pos, struct MbusTelegramRef* ref) const;
+  void drop_oldest();
+  
+  uint8_t* buffer_{nullptr};
+  uint16_t capacity_{0};
+  uint16_t head_{0}; //oldest frame
+  uint16_t tail_{0}; //where the next frame goes
+  uint16_t newest_{0};
+  uint16_t end_{0}; //end of frames at the top of the buffer, while wrapped
+  uint16_t count_{0};
+  bool wrapped_{false}; //frames from head_ to end_, then from 0 to tail_
+};
+
+}  // namespace mbus
+}  // namespace esphome
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+#include "esphome/core/log.h"
+
+/* Per-state, per-frame and per-record logging of the mbus component goes
+ * through MBUS_LOGD, which compiles to nothing unless both MBUS_LOG_LEVEL
+ * (the log_level option of the component) and the logger's level are at
+ * least DEBUG. Warnings and errors are always logged as usual.
+ * */
+#ifndef MBUS_LOG_LEVEL
+#define MBUS_LOG_LEVEL ESPHOME_LOG_LEVEL
+#endif
+
+#if (MBUS_LOG_LEVEL >= ESPHOME_LOG_LEVEL_DEBUG) && (ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_DEBUG)
+#define MBUS_LOG_DETAIL 1
+#define MBUS_LOGD(tag, ...) ESP_LOGD(tag, __VA_ARGS__)
+#else
+#define MBUS_LOG_DETAIL 0
+#define MBUS_LOGD(tag, ...) \
+  do { \
+  } while (0)
+#endif
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace esphome {
+namespace mbus {
+
+/* Lock-free byte queue between exactly one producer and one consumer
+ * thread, e.g. the RX task of a bus and the main loop. Depends on nothing
+ * but std::atomic, so it runs the same under FreeRTOS and std::thread.
+ *
+ * head_ and tail_ run freely and wrap at 2^32, their difference is the fill
+ * level: all N bytes can be used. N must be a power of two.
+ * */
+template<uint16_t N> class MbusSpscQueue {
+  static_assert( N && !( N & (N - 1) ), "MbusSpscQueue size must be a power of two" );
+
+ public:
+  //producer: append up to len bytes, returns how many fit
+  uint16_t push(const uint8_t* data, uint16_t len) {
+    const uint32_t head = this->head_.load(std::memory_order_relaxed);
+    const uint32_t space = N - ( head - this->tail_.load(std::memory_order_acquire) );
+    if(len > space) len = space;
+    for(uint16_t i=0; i<len; i++) this->buffer_[(head + i) & (N - 1)] = data[i];
+    this->head_.store(head + len, std::memory_order_release);
+    return len;
+  }
+
+  //consumer: bytes ready to be popped
+  uint16_t available() const {
+    return this->head_.load(std::memory_order_acquire) - this->tail_.load(std::memory_order_relaxed);
+  }
+
+  //consumer: take up to len bytes, returns how many there were
+  uint16_t pop(uint8_t* data, uint16_t len) {
+    const uint32_t tail = this->tail_.load(std::memory_order_relaxed);
+    const uint32_t ready = this->head_.load(std::memory_order_acquire) - tail;
+    if(len > ready) len = ready;
+    for(uint16_t i=0; i<len; i++) data[i] = this->buffer_[(tail + i) & (N - 1)];
+    this->tail_.store(tail + len, std::memory_order_release);
+    return len;
+  }
+
+  //consumer: drop everything pushed so far
+  void clear() { this->tail_.store(this->head_.load(std::memory_order_acquire), std::memory_order_release); }
+
+ protected:
+  uint8_t buffer_[N];
+  std::atomic<uint32_t> head_{0}; //written by the producer only
+  std::atomic<uint32_t> tail_{0}; //written by the consumer only
+};
+
+}  // namespace mbus
+}  // namespace esphome
@@ -1,6 +1,40 @@
 import esphome.codegen as cg
 from esphome.components import mbus, sensor
 import esphome.config_validation as cv
+import esphome.final_validate as fv
+
+from esphome.const import (
+    CONF_ACCURACY_DECIMALS,
+    CONF_DEVICE_CLASS,
+    CONF_FILTERS,
+    CONF_ID,
+    CONF_MULTIPLY,
+    CONF_NAME,
+    CONF_PLATFORM,
+    CONF_RESTORE_VALUE,
+    CONF_SENSOR,
+    CONF_STATE_CLASS,
+    CONF_UNIT_OF_MEASUREMENT,
+    DEVICE_CLASS_DURATION,
+    DEVICE_CLASS_ENERGY,
+    DEVICE_CLASS_POWER,
+    DEVICE_CLASS_PRESSURE,
+    DEVICE_CLASS_TEMPERATURE,
+    DEVICE_CLASS_VOLUME,
+    DEVICE_CLASS_VOLUME_FLOW_RATE,
+    DEVICE_CLASS_WEIGHT,
+    ENTITY_CATEGORY_DIAGNOSTIC,
+    STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
+    UNIT_CELSIUS,
+    UNIT_CUBIC_METER,
+    UNIT_KILOGRAM,
+    UNIT_KILOWATT_HOURS,
+    UNIT_MILLISECOND,
+    UNIT_PERCENT,
+    UNIT_WATT,
+)
+from esphome.core import CORE
 
 from .. import mbus_ns
 
@@ -12,11 +46,20 @@ CONF_MBUS_FUNCTION = "mbus_function"
 CONF_MBUS_TARIFF = "mbus_tariff"
 CONF_MBUS_SUBUNIT = "mbus_subunit"
 CONF_MBUS_VIFE = "mbus_vife"
+CONF_MBUS_STATISTIC = "mbus_statistic"
+CONF_MBUS_RAW = "mbus_raw"
 
 MbusSensor = mbus_ns.class_(
     "MbusSensor", sensor.Sensor, cg.Component
 )
 
+MbusStatisticSensor = mbus_ns.class_(
+    "MbusStatisticSensor", sensor.Sensor, cg.PollingComponent
+)
+
+MbusRecordKey = mbus_ns.struct("MbusRecordKey")
+MbusRecordSlot = mbus_ns.struct("MbusRecordSlot")
+
 MbusDIFFunction = mbus_ns.enum("MbusDIFFunction")
 MBUS_DIF_FUNCTION = {
     "INSTANT": MbusDIFFunction.MBUS_INSTANT_VALUE,
@@ -24,8 +67,183 @@ MBUS_DIF_FUNCTION = {
     "MINIMUM": MbusDIFFunction.MBUS_MINIMUM_VALUE,
     "ERROR": MbusDIFFunction.MBUS_ERROR_VALUE,
 }
+#DIF function field values, must match enum MbusDIFFunction
+MBUS_DIF_FUNCTION_CODE = {
+    "INSTANT": 0x00,
+    "MAXIMUM": 0x10,
+    "MINIMUM": 0x20,
+    "ERROR": 0x30,
+}
+
+MbusStatistic = mbus_ns.enum("MbusStatistic")
+MBUS_STATISTIC = {
+    "TRANSACTIONS": MbusStatistic.MBUS_STATISTIC_TRANSACTIONS,
+    "FAILED_TRANSACTIONS": MbusStatistic.MBUS_STATISTIC_FAILED_TRANSACTIONS,
+    "RETRIES": MbusStatistic.MBUS_STATISTIC_RETRIES,
+    "ACK_TIMEOUTS": MbusStatistic.MBUS_STATISTIC_ACK_TIMEOUTS,
+    "HEADER_TIMEOUTS": MbusStatistic.MBUS_STATISTIC_HEADER_TIMEOUTS,
+    "DATA_TIMEOUTS": MbusStatistic.MBUS_STATISTIC_DATA_TIMEOUTS,
+    "COLLISIONS": MbusStatistic.MBUS_STATISTIC_COLLISIONS,
+    "INVALID_HEADERS": MbusStatistic.MBUS_STATISTIC_INVALID_HEADERS,
+    "CHECKSUM_ERRORS": MbusStatistic.MBUS_STATISTIC_CHECKSUM_ERRORS,
+    "BYTES_RECEIVED": MbusStatistic.MBUS_STATISTIC_BYTES_RECEIVED,
+    "UNCHANGED_READOUTS": MbusStatistic.MBUS_STATISTIC_UNCHANGED_READOUTS,
+    "MISSED_DEADLINES": MbusStatistic.MBUS_STATISTIC_MISSED_DEADLINES,
+    "SUSPENSIONS": MbusStatistic.MBUS_STATISTIC_SUSPENSIONS,
+    "BUS_UTILIZATION": MbusStatistic.MBUS_STATISTIC_BUS_UTILIZATION,
+    "RESET_LATENCY": MbusStatistic.MBUS_STATISTIC_RESET_LATENCY,
+    "SELECT_LATENCY": MbusStatistic.MBUS_STATISTIC_SELECT_LATENCY,
+    "HEADER_LATENCY": MbusStatistic.MBUS_STATISTIC_HEADER_LATENCY,
+    "DATA_LATENCY": MbusStatistic.MBUS_STATISTIC_DATA_LATENCY,
+    "TRANSACTION_LATENCY": MbusStatistic.MBUS_STATISTIC_TRANSACTION_LATENCY,
+}
+
+VIFE_EXTENSION_MASK = 0x80
+
+
+def validate_vif_vife(value):
+    """Reject VIF/VIFE values no Data Record can ever be decoded to.
+
+    The decoder shifts VIF and VIFEs into a 64-bit integer for as long as
+    the extension bit is set, so every byte but the last must have it set,
+    and the last must not (unless the chain was truncated at 8 bytes).
+    """
+    value = cv.int_range(0x0000000000000000, 0xffffffffffffffff)(value)
+    chain = list(value.to_bytes(8, "big").lstrip(b"\x00")) or [0x00]
+    for byte in chain[:-1]:
+        if not byte & VIFE_EXTENSION_MASK:
+            raise cv.Invalid(
+                f"0x{value:X} is not a valid VIF/VIFE chain: byte 0x{byte:02X} "
+                "is followed by another byte but has no extension bit set"
+            )
+    if len(chain) < 8 and chain[-1] & VIFE_EXTENSION_MASK:
+        raise cv.Invalid(
+            f"0x{value:X} is not a valid VIF/VIFE chain: last byte 0x{chain[-1]:02X} "
+            "has the extension bit set"
+        )
+    return value
+
+
+DURATION_UNITS = ["s", "min", "h", "d"]
+
+
+def vif_unit(vif_vife):
+    """Decimal exponent, unit, device class and state class of the value of a
+    VIF/VIFE chain, or None if it has no decimal scale. The exponent must match
+    MbusVIFExponent() in mbus_datarecord.h."""
+    chain = list(vif_vife.to_bytes(8, "big").lstrip(b"\x00")) or [0x00]
+    vif = chain[0] & 0x7F
+    correction = 0
+    if len(chain) > 1:
+        # only a single multiplicative correction factor VIFE is understood
+        if (chain[1] & 0x78) != 0x70 or len(chain) > 2:
+            return None
+        correction = (chain[1] & 0x07) - 6
+    n3 = vif & 0x07
+    n2 = vif & 0x03
+    total = STATE_CLASS_TOTAL_INCREASING
+    measurement = STATE_CLASS_MEASUREMENT
+    if vif <= 0x07:
+        unit = (n3 - 6, UNIT_KILOWATT_HOURS, DEVICE_CLASS_ENERGY, total)
+    elif vif <= 0x0F:
+        unit = (n3 - 6, "MJ", DEVICE_CLASS_ENERGY, total)
+    elif vif <= 0x17:
+        unit = (n3 - 6, UNIT_CUBIC_METER, DEVICE_CLASS_VOLUME, total)
+    elif vif <= 0x1F:
+        unit = (n3 - 3, UNIT_KILOGRAM, DEVICE_CLASS_WEIGHT, total)
+    elif vif <= 0x27:
+        unit = (0, DURATION_UNITS[n2], DEVICE_CLASS_DURATION, total)
+    elif vif <= 0x2F:
+        unit = (n3 - 3, UNIT_WATT, DEVICE_CLASS_POWER, measurement)
+    elif vif <= 0x37:
+        unit = (n3 - 3, "kJ/h", None, measurement)
+    elif vif <= 0x3F:
+        unit = (n3 - 6, "m³/h", DEVICE_CLASS_VOLUME_FLOW_RATE, measurement)
+    elif vif <= 0x47:
+        unit = (n3 - 7, "m³/min", None, measurement)
+    elif vif <= 0x4F:
+        unit = (n3 - 9, "m³/s", None, measurement)
+    elif vif <= 0x57:
+        unit = (n3 - 3, "kg/h", None, measurement)
+    elif vif <= 0x5F or 0x64 <= vif <= 0x67:
+        unit = (n2 - 3, UNIT_CELSIUS, DEVICE_CLASS_TEMPERATURE, measurement)
+    elif vif <= 0x63:
+        # temperature difference, not convertible like a temperature
+        unit = (n2 - 3, "K", None, measurement)
+    elif vif <= 0x6B:
+        unit = (n2 - 3, "bar", DEVICE_CLASS_PRESSURE, measurement)
+    elif vif == 0x6E:
+        unit = (0, None, None, measurement)
+    elif 0x70 <= vif <= 0x77:
+        unit = (0, DURATION_UNITS[n2], DEVICE_CLASS_DURATION, measurement)
+    else:
+        return None
+    exponent, unit_of_measurement, device_class, state_class = unit
+    return (exponent + correction, unit_of_measurement, device_class, state_class)
+
+
+def record_defaults(config):
+    """Fill in unit, device class, state class and decimals from the VIF,
+    unless given or the raw value is to be published."""
+    if not isinstance(config, dict) or config.get(CONF_MBUS_RAW, False):
+        return config
+    try:
+        unit = vif_unit(validate_vif_vife(config.get(CONF_MBUS_VIFE)))
+    except cv.Invalid:
+        return config  # reported by the schema
+    if unit is None:
+        return config
+    exponent, unit_of_measurement, device_class, state_class = unit
+    config = dict(config)
+    config.setdefault(CONF_ACCURACY_DECIMALS, max(0, -exponent))
+    if unit_of_measurement is not None:
+        config.setdefault(CONF_UNIT_OF_MEASUREMENT, unit_of_measurement)
+    if device_class is not None:
+        config.setdefault(CONF_DEVICE_CLASS, device_class)
+    config.setdefault(CONF_STATE_CLASS, state_class)
+    return config
+
+
+def validate_scaling(config):
+    """A multiply filter written for the raw value of a scaled VIF would scale
+    it a second time: such configurations have to choose one or the other."""
+    if config[CONF_MBUS_RAW]:
+        return config
+    unit = vif_unit(config[CONF_MBUS_VIFE])
+    if unit is None or unit[0] == 0:
+        return config
+    if any(CONF_MULTIPLY in f for f in config.get(CONF_FILTERS, [])):
+        raise cv.Invalid(
+            f"The value of VIF/VIFE 0x{config[CONF_MBUS_VIFE]:X} is already scaled by "
+            f"1e{unit[0]} to {unit[1]}; remove the multiply filter, or set "
+            f"'{CONF_MBUS_RAW}: true' to keep publishing the raw value",
+            [CONF_FILTERS],
+        )
+    return config
+
 
-CONFIG_SCHEMA = (
+def record_key(config):
+    """Fixed-width key of a sensor, must match struct MbusRecordKey and
+    MbusPackRecordAttributes() (sorted as a tuple)."""
+    attributes = (
+        config[CONF_MBUS_TARIFF]
+        | (config[CONF_MBUS_SUBUNIT] << 20)
+        | ((MBUS_DIF_FUNCTION_CODE[config[CONF_MBUS_FUNCTION]] >> 4) << 30)
+    )
+    return (config[CONF_MBUS_VIFE], config[CONF_MBUS_STORAGE], attributes)
+
+
+def mbus_sensor_configs(full_config, mbus_id):
+    return [
+        conf
+        for conf in full_config.get(CONF_SENSOR, [])
+        if conf[CONF_PLATFORM] == "mbus"
+        and CONF_MBUS_VIFE in conf
+        and conf[CONF_MBUS_ID].id == mbus_id.id
+    ]
+
+
+RECORD_SCHEMA = (
     sensor.sensor_schema(
         MbusSensor,
         accuracy_decimals=1,
@@ -39,21 +257,114 @@ CONFIG_SCHEMA = (
             ),
             cv.Optional(CONF_MBUS_TARIFF, default=0): cv.int_range(0, 0xfffff),
             cv.Optional(CONF_MBUS_SUBUNIT, default=0): cv.int_range(0, 0x3ff),
-            cv.Required(CONF_MBUS_VIFE): cv.int_range(0x0000000000000000, 0xffffffffffffffff),
+            cv.Required(CONF_MBUS_VIFE): validate_vif_vife,
+            cv.Optional(CONF_MBUS_RAW, default=False): cv.boolean,
+            cv.Optional(CONF_RESTORE_VALUE, default=False): cv.boolean,
         }
     )
     .extend(cv.COMPONENT_SCHEMA)
 )
 
 
+def statistic_schema(**kwargs):
+    return (
+        sensor.sensor_schema(
+            MbusStatisticSensor,
+            accuracy_decimals=0,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            **kwargs,
+        )
+        .extend(
+            {
+                cv.GenerateID(CONF_MBUS_ID): cv.use_id(mbus.Mbus),
+                cv.Required(CONF_MBUS_STATISTIC): cv.enum(MBUS_STATISTIC, upper=True),
+            }
+        )
+        .extend(cv.polling_component_schema("60s"))
+    )
+
+
+COUNTER_SCHEMA = statistic_schema(state_class=STATE_CLASS_TOTAL_INCREASING)
+BYTES_SCHEMA = statistic_schema(unit_of_measurement="B", state_class=STATE_CLASS_TOTAL_INCREASING)
+LATENCY_SCHEMA = statistic_schema(
+    unit_of_measurement=UNIT_MILLISECOND, state_class=STATE_CLASS_MEASUREMENT
+)
+UTILIZATION_SCHEMA = statistic_schema(
+    unit_of_measurement=UNIT_PERCENT, accuracy_decimals=1, state_class=STATE_CLASS_MEASUREMENT
+)
+
+
+def CONFIG_SCHEMA(config):
+    """Sensors either return a data record (mbus_vife) or, as diagnostic
+    sensors, a transaction statistic of their mbus instance."""
+    if isinstance(config, dict) and CONF_MBUS_STATISTIC in config:
+        statistic = str(config[CONF_MBUS_STATISTIC]).upper()
+        if statistic.endswith("_LATENCY"):
+            return LATENCY_SCHEMA(config)
+        if statistic == "BYTES_RECEIVED":
+            return BYTES_SCHEMA(config)
+        if statistic == "BUS_UTILIZATION":
+            return UTILIZATION_SCHEMA(config)
+        return COUNTER_SCHEMA(config)
+    return validate_scaling(RECORD_SCHEMA(record_defaults(config)))
+
+
+def _final_validate(config):
+    if CONF_MBUS_STATISTIC in config:
+        return config
+    key = record_key(config)
+    matching = [
+        conf
+        for conf in mbus_sensor_configs(fv.full_config.get(), config[CONF_MBUS_ID])
+        if record_key(conf) == key
+    ]
+    if len(matching) > 1:
+        names = ", ".join(conf.get(CONF_NAME, str(conf[CONF_ID])) for conf in matching)
+        raise cv.Invalid(
+            f"Sensors {names} request the same data record of the same mbus instance"
+        )
+    return config
+
+
+FINAL_VALIDATE_SCHEMA = _final_validate
+
+
 async def to_code(config):
     var = await sensor.new_sensor(config)
     await cg.register_component(var, config)
 
     parent = await cg.get_variable(config[CONF_MBUS_ID])
     cg.add(var.set_parent(parent))
+    if CONF_MBUS_STATISTIC in config:
+        cg.add(var.set_statistic(config[CONF_MBUS_STATISTIC]))
+        return
+
     cg.add(var.set_mbus_storage(config[CONF_MBUS_STORAGE]))
     cg.add(var.set_mbus_function(config[CONF_MBUS_FUNCTION]))
     cg.add(var.set_mbus_tariff(config[CONF_MBUS_TARIFF]))
     cg.add(var.set_mbus_subunit(config[CONF_MBUS_SUBUNIT]))
     cg.add(var.set_mbus_vife(config[CONF_MBUS_VIFE]))
+    cg.add(var.set_mbus_raw(config[CONF_MBUS_RAW]))
+    cg.add(var.set_restore_value(config[CONF_RESTORE_VALUE]))
+
+    #one sorted key table per mbus instance, emitted along with its first sensor
+    keys = sorted(
+        record_key(conf) for conf in mbus_sensor_configs(CORE.config, config[CONF_MBUS_ID])
+    )
+    table = f"mbus_record_keys_{config[CONF_MBUS_ID].id}"
+    slots = f"mbus_record_slots_{config[CONF_MBUS_ID].id}"
+    emitted = CORE.data.setdefault("mbus", {}).setdefault("record_tables", set())
+    if table not in emitted:
+        emitted.add(table)
+        entries = ",\n  ".join(
+            f"{{0x{vif_vife:X}ULL, 0x{storage:X}ULL, 0x{attributes:X}UL}}"
+            for vif_vife, storage, attributes in keys
+        )
+        cg.add_global(
+            cg.RawStatement(
+                f"static constexpr {MbusRecordKey} {table}[] = {{\n  {entries}\n}};"
+            )
+        )
+        cg.add_global(cg.RawStatement(f"static {MbusRecordSlot} {slots}[{len(keys)}];"))
+        cg.add(parent.set_record_table(cg.RawExpression(table), cg.RawExpression(slots), len(keys)))
+    cg.add(var.set_record_index(keys.index(record_key(config))))
@@ -1,6 +1,11 @@
 #include "mbus_sensor.h"
 
 #include "esphome/core/log.h"
+#include "../mbus_log.h"
+
+#include <cinttypes>
+#include <cstring>
+#include <ctime>
 
 namespace esphome {
 namespace mbus {
@@ -8,151 +13,118 @@ namespace mbus {
 static const char *const TAG = "mbus.sensor";
 
 void MbusSensor::setup() {
-  this->telegram_seen = 0;
+  this->parent_->add_on_telegram_callback([this](bool force) { this->process_telegram(force); });
+  if(!this->restore_value_) return;
+  
+  //a different record under the same name is not restored
+  this->pref_ = global_preferences->make_preference<MbusRestoreState>(this->get_object_id_hash() ^
+    (uint32_t) (this->mbus_vif_vife_requested_ ^ (this->mbus_vif_vife_requested_ >> 32) ^ this->mbus_storage_requested_), true);
+  //the latest value is saved at most every mbus_restore_save_interval_ms_, not from the publish path
+  this->set_interval("restore", mbus_restore_save_interval_ms_, [this]() {
+    if(this->save_pending_) this->save_value();
+  });
+  if(!this->pref_.load(&(this->restore_state_))) return;
+  
+  //the age is only known if the clock was set when the value was saved and is set now
+  uint32_t now = ::time(nullptr);
+  if( (this->restore_state_.timestamp > mbus_restore_valid_time_) && (now >= this->restore_state_.timestamp) )
+    ESP_LOGI(TAG, "%s: Restored stale value of access number %d, %us old", this->get_name().c_str(),
+      this->restore_state_.access_number, now - this->restore_state_.timestamp);
+  else
+    ESP_LOGI(TAG, "%s: Restored stale value of access number %d", this->get_name().c_str(), this->restore_state_.access_number);
+  this->stale_ = true;
+  this->publish_value(this->restore_state_.value, this->restore_state_.datatype);
+}
+
+/* last value not saved yet because of the rate limit: saving it now, before
+ * preferences are written to flash on shutdown
+ * */
+void MbusSensor::on_safe_shutdown() {
+  if(this->save_pending_) this->save_value();
+}
+
+/* a preference that could not be allocated (on the ESP8266, when the space
+ * for preferences in RTC memory or flash is used up) fails every save
+ * */
+void MbusSensor::save_value() {
+  this->save_pending_ = false;
+  if(this->pref_.save(&(this->restore_state_))) return;
+  if(!this->save_failed_){
+	  ESP_LOGW(TAG, "%s: Could not save value, it is not restored at next boot (preferences full?)",
+	    this->get_name().c_str());
+  }
+  this->save_failed_ = true;
 }
 
 float MbusSensor::get_setup_priority() const {   return setup_priority::BUS - 1.0f; }
 void MbusSensor::dump_config() {
   LOG_SENSOR("", "Mbus Sensor", this);
-  ESP_LOGCONFIG(TAG, "  Secondary address: %llX" , this->parent_->secondary_address);
-  ESP_LOGCONFIG(TAG, "  Storage number: %lld" , this->mbus_storage_requested_);
+  ESP_LOGCONFIG(TAG, "  Meter: %s" , this->parent_->get_address_str());
+  ESP_LOGCONFIG(TAG, "  Storage number: %" PRIu64 , this->mbus_storage_requested_);
   ESP_LOGCONFIG(TAG, "  Function: %s" , MbusDIFFunctionToStr(this->mbus_function_requested_));
   ESP_LOGCONFIG(TAG, "  Tariff: %d" , this->mbus_tariff_requested_);
   ESP_LOGCONFIG(TAG, "  Subunit: %d" , this->mbus_subunit_requested_);
-  ESP_LOGCONFIG(TAG, "  VIF/VIFE: 0x%llX" , this->mbus_vif_vife_requested_);
+  ESP_LOGCONFIG(TAG, "  VIF/VIFE: 0x%" PRIX64 , this->mbus_vif_vife_requested_);
+  if( !this->mbus_raw_ && (this->mbus_exponent_ != MBUS_VIF_NO_SCALE) ){
+    ESP_LOGCONFIG(TAG, "  Scale: 10^%d" , this->mbus_exponent_);
+  }
+  if(this->restore_value_){
+    ESP_LOGCONFIG(TAG, "  Restore value: YES%s" , this->save_failed_ ? ", but could not save it" : "");
+  }
 }
 
-void MbusSensor::loop() {
+void MbusSensor::process_telegram(bool force) {
 
-  //check if new telegram is available
-  if(this->telegram_seen == this->parent_->telegram_count)return;
-  this->telegram_seen = this->parent_->telegram_count;
-  
-  const char* sensorname=this->get_name().c_str();
-  
-  //new telegram is available, parsing it
-  uint8_t* tg = this->parent_->telegram;
-  uint16_t len = tg[1] + 6; //payload + (start + length + length + start + checksum + stop)
+  //new telegram is available and already decoded by parent, picking up our result
+  const struct MbusRecordSlot* slot = this->parent_->get_record_slot(this->record_index_);
   
-  //tg[0] to tg[2] checked by statemachine
-  //tg[3] start byte
-  
-  if(tg[4] != MBUS_CONTROL_RSP_UD){
-	  ESP_LOGE(TAG, " %s: Unexpected control field %d", sensorname, tg[4]);
+  if( !slot->match_count ){
+	  ESP_LOGE(TAG, " %s: Specified data record not in telegram", this->get_name().c_str());
 	  return;
   }
   
-  //tg[5] primary address (usually 0 anyway)
-  
-  if(tg[6] != MBUS_CI_RESP_VARIABLE){
-	  ESP_LOGE(TAG, " %s: Unexpected control information field %d", sensorname, tg[6]);
+  if( slot->match_count > 1 ){
+	  ESP_LOGE(TAG, " %s: Multiple matching data records in telegram", this->get_name().c_str());
 	  return;
   }
   
-  //tg[7] to tg[14] secondary address
-  
-  std::string secondary_address_str;
-  char buf[5];
-  uint16_t pos;
-  for(pos=10;pos>=7;pos--){
-	sprintf(buf, "%02X", tg[pos]);
-    secondary_address_str += buf;
-  }
-  for(pos=11;pos<=14;pos++){
-	sprintf(buf, "%02X", tg[pos]);
-    secondary_address_str += buf;
-  }
-  ESP_LOGD(TAG, " %s: Secondary address received: %s", sensorname, secondary_address_str.c_str());
-  
-  //tg[15] access number
-  
-  if(tg[16] & MBUS_STATUS_APP_ERROR){
-	  ESP_LOGE(TAG, " %s: Application error", sensorname);
+  if( !slot->has_value ){
+	  ESP_LOGE(TAG, " %s: Data record carries no numeric value", this->get_name().c_str());
 	  return;
   }
-  if(tg[16] & MBUS_STATUS_TEMPORARY_ERROR){
-	   ESP_LOGW(TAG, " %s: Temporary error status bit set", sensorname);
-  }
-  if(tg[16] & MBUS_STATUS_PERMANENT_ERROR){
-	  ESP_LOGW(TAG, " %s: Permanent error status bit set. Consider replacing meter.", sensorname);
-  }
-  if(tg[16] & MBUS_STATUS_LOW_POWER){
-	  ESP_LOGW(TAG, " %s: Low power status bit set. Consider replacing meter.", sensorname);
-  }
   
-  //tg[17] to tg[18] signature
-  if(tg[17] || tg[18]){
-	  ESP_LOGE(TAG, " %s: Nonzero signature field, possible encryption", sensorname);
-	  return;
-  }
-  
-  ESP_LOGD(TAG, " %s: Parsing fixed header done", sensorname);
-  
-  //variable payload fields follow
-  pos = 19;
-  this->mbus_data_record_parse_status_ = 0;
-  while( ( pos <= (len-3) ) &&
-	( tg[pos] != MBUS_DIF_MANUFACTURER_SPECIFIC ) &&
-	( tg[pos] != MBUS_DIF_MANUFACTURER_SPECIFIC_MULTIFRAME ) )
-  { //each iteration of the while loop processes one Data Record,
-	  //beginning with pos pointing at DIF. Iteration ends with
-	  //pos pointing at DIF of next Data Record.
-	  
-	  if(tg[pos] == MBUS_DIF_FILLER) {
-		  pos++;
-		  continue;
-	  }
-
-	  uint8_t ret = MbusParseDataRecord(&tg[pos]);
-	  if(!ret) { //error logging is done in MbusParseDataRecord
-	    pos=0;
-	    ESP_LOGW(TAG, " %s: Variable payload parsing aborted", sensorname);
-	    break;
-	  } 
-	  pos+=ret;
-  } //end while
-  
-  if(pos) { ESP_LOGD(TAG, " %s: Parsing variable payload done", sensorname); }
-
-  if( pos > (len-3) ){
-	  ESP_LOGW(TAG, " %s: Overrun while parsing telegram.", sensorname);
-	  pos=0;
-  }
-    
-  //manufacturer-specific data
-  if(pos && (tg[pos] == MBUS_DIF_MANUFACTURER_SPECIFIC_MULTIFRAME)){
-	  ESP_LOGW(TAG, " %s: Multitelegram readout not supported, some data may be unavailable.", sensorname);
+  //publishing only values that moved, unless asked to by heartbeat
+  bool stale = this->stale_;
+  this->stale_ = false;
+  if( !force && this->published_ && (slot->datatype == this->last_datatype_) &&
+    !memcmp(&(slot->value), &(this->last_value_), sizeof(slot->value)) ){
+	  MBUS_LOGD(TAG, " %s: Value unchanged", this->get_name().c_str());
+	  if(!stale) return;
+  } else {
+	  this->publish_value(slot->value, slot->datatype);
   }
   
+  if(!this->restore_value_) return;
+  this->restore_state_.value = slot->value;
+  this->restore_state_.datatype = slot->datatype;
+  this->restore_state_.access_number = this->parent_->get_access_number();
+  this->restore_state_.timestamp = ::time(nullptr);
+  /* preferences are only written to flash every flash_write_interval anyway, together
+   * with those of all other sensors; saving each value at most every
+   * mbus_restore_save_interval_ms_ on top, the latest one at the end of it */
+  this->save_pending_ = true;
+}
 
-  if(pos && ( (tg[pos] == MBUS_DIF_MANUFACTURER_SPECIFIC)
-    || (tg[pos] == MBUS_DIF_MANUFACTURER_SPECIFIC_MULTIFRAME) ) ) {
-    pos++;
-    uint16_t mfg_specific_begin = pos;
-    std::string manufacturer_specific_data;
-    for(pos=len-3;pos>=mfg_specific_begin;pos--){
-	  sprintf(buf, "%02X ", tg[pos]);
-      manufacturer_specific_data += buf;
-    }
-    ESP_LOGD(TAG, " %s: Manufacturer-specific data: %s", sensorname, manufacturer_specific_data.c_str());
-  }
-  
-  //tg[len-2] checksum (verified by statemachine)
-  //tg[len-1] stop byte
-  
-  if( !this->mbus_data_record_parse_status_ ){
-	  ESP_LOGE(TAG, " %s: Specified data record not in telegram", sensorname);
-	  return;
-  }
-  
-  if( this->mbus_data_record_parse_status_ > 1 ){
-	  ESP_LOGE(TAG, " %s: Multiple matching data records in telegram", sensorname);
-	  return;
-  }
-  
-  ESP_LOGI(TAG, "%s: New raw value: %.1f", sensorname, this->mbus_data_record_parse_result_);
-  this->publish_state(this->mbus_data_record_parse_result_);
-  
+void MbusSensor::publish_value(union MbusValue value, enum MbusDIFDatatype datatype) {
+  this->last_value_ = value;
+  this->last_datatype_ = datatype;
+  this->published_ = true;
+  
+  //exact up to here, VIF scaling is the only floating point operation before publishing
+  double raw = (datatype == MBUS_REAL) ? value.real : (double) value.integer;
+  double result = this->mbus_raw_ ? raw : MbusScaleValue(raw, this->mbus_exponent_);
+  ESP_LOGI(TAG, "%s: New value: %g", this->get_name().c_str(), result);
+  this->publish_state(result);
 }
 
 }  // namespace mbus
@@ -0,0 +1,51 @@
+#include "mbus_statistic_sensor.h"
+
+#include "esphome/core/log.h"
+#include <cmath>
+
+namespace esphome {
+namespace mbus {
+
+static const char *const TAG = "mbus.statistic";
+
+static const char* MbusStatisticToStr(enum MbusStatistic statistic) {
+  switch(statistic){
+    case MBUS_STATISTIC_TRANSACTIONS: return "transactions";
+    case MBUS_STATISTIC_FAILED_TRANSACTIONS: return "failed transactions";
+    case MBUS_STATISTIC_RETRIES: return "retries";
+    case MBUS_STATISTIC_ACK_TIMEOUTS: return "ACK timeouts";
+    case MBUS_STATISTIC_HEADER_TIMEOUTS: return "header timeouts";
+    case MBUS_STATISTIC_DATA_TIMEOUTS: return "data timeouts";
+    case MBUS_STATISTIC_COLLISIONS: return "collisions";
+    case MBUS_STATISTIC_INVALID_HEADERS: return "invalid headers";
+    case MBUS_STATISTIC_CHECKSUM_ERRORS: return "checksum errors";
+    case MBUS_STATISTIC_BYTES_RECEIVED: return "bytes received";
+    case MBUS_STATISTIC_UNCHANGED_READOUTS: return "unchanged readouts";
+    case MBUS_STATISTIC_MISSED_DEADLINES: return "missed deadlines";
+    case MBUS_STATISTIC_SUSPENSIONS: return "suspensions";
+    case MBUS_STATISTIC_BUS_UTILIZATION: return "bus utilization";
+    case MBUS_STATISTIC_RESET_LATENCY: return "reset latency";
+    case MBUS_STATISTIC_SELECT_LATENCY: return "select latency";
+    case MBUS_STATISTIC_HEADER_LATENCY: return "header latency";
+    case MBUS_STATISTIC_DATA_LATENCY: return "data latency";
+    case MBUS_STATISTIC_TRANSACTION_LATENCY: return "transaction latency";
+    default: return "unknown";
+  }
+}
+
+float MbusStatisticSensor::get_setup_priority() const {   return setup_priority::DATA; }
+void MbusStatisticSensor::dump_config() {
+  LOG_SENSOR("", "Mbus Statistic Sensor", this);
+  ESP_LOGCONFIG(TAG, "  Meter: %s" , this->parent_->get_address_str());
+  ESP_LOGCONFIG(TAG, "  Statistic: %s" , MbusStatisticToStr(this->statistic_));
+}
+
+void MbusStatisticSensor::update() {
+  float value = this->parent_->get_statistic(this->statistic_);
+  //latencies are not published until observed
+  if(std::isnan(value)) return;
+  this->publish_state(value);
+}
+
+}  // namespace mbus
+}  // namespace esphome
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "esphome/core/component.h"
+#include "esphome/components/sensor/sensor.h"
+#include "esphome/components/mbus/mbus.h"
+
+namespace esphome {
+namespace mbus {
+	
+/* Diagnostic sensor publishing one of the transaction statistics of an
+ * Mbus instance every update_interval.
+ * */
+class MbusStatisticSensor : public sensor::Sensor, public PollingComponent {
+ public:
+  void set_parent(Mbus* parent) { parent_ = parent; }
+  void set_statistic(enum MbusStatistic statistic) { statistic_ = statistic; }
+  void update() override;
+  void dump_config() override;
+  float get_setup_priority() const override;
+
+ protected:
+  Mbus* parent_;
+  enum MbusStatistic statistic_;
+  
+};
+
+}  // namespace mbus
+}  // namespace esphome
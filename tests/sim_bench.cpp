@@ -0,0 +1,65 @@
+/* Throughput of a simulated bus: N meters with random latency and a few
+ * faults, all on the same update_interval, read for some simulated time.
+ *
+ *   sim_bench [meters] [baud rate] [update interval s] [simulated minutes]
+ *
+ * Reports readouts per minute against the number asked for, bus
+ * utilization, missed deadlines and failures, and how fast the host ran it.
+ * */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "esphome_test.h"
+#include "sim_bus.h"
+
+using namespace esphome;
+using namespace esphome::mbus;
+using namespace mbus_test;
+
+int main(int argc, char **argv) {
+  uint32_t meters = argc > 1 ? atoi(argv[1]) : 16;
+  uint32_t baud_rate = argc > 2 ? atoi(argv[2]) : 2400;
+  uint32_t interval_s = argc > 3 ? atoi(argv[3]) : 30;
+  uint32_t minutes = argc > 4 ? atoi(argv[4]) : 60;
+
+  test::seed(1);
+  SimBus *bus = new SimBus(baud_rate, 1);
+  std::vector<Mbus *> instances;
+  for (uint32_t i = 0; i < meters; i++) {
+    SimMeter &meter = bus->add_meter(0x10000000 + i);
+    meter.frames = {{0x04, 0x13, (uint8_t) i, 0x00, 0x00, 0x00, 0x04, 0x06, 0x10, 0x27, 0x00, 0x00, 0x02, 0x5B, 0x2A, 0x00,
+                     0x02, 0x5F, 0x20, 0x00, 0x04, 0x3B, 0x00, 0x01, 0x00, 0x00}};
+    meter.latency_ms = 20 + (i * 37) % 60;
+    meter.drop_rate = 0.0005;
+    meter.corrupt_rate = 0.002;
+    Mbus *mbus = sim_mbus(bus, meter.address(), interval_s * 1000);
+    sim_record_table(mbus, {0x13, 0x06, 0x5B, 0x5F, 0x3B});
+    instances.push_back(mbus);
+  }
+  for (Mbus *mbus : instances) mbus->call_setup();
+
+  auto start = std::chrono::steady_clock::now();
+  uint32_t sim_start = test::now();
+  test::advance(minutes * 60000);
+  double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  uint32_t sim_ms = test::now() - sim_start;
+
+  uint64_t readouts = 0, failed = 0, missed = 0, retries = 0;
+  for (auto &meter : bus->meters) readouts += meter.readouts;
+  for (Mbus *mbus : instances) {
+    failed += mbus->get_stats()->failed_transactions;
+    missed += mbus->get_stats()->missed_deadlines;
+    retries += mbus->get_stats()->retries;
+  }
+  double sim_min = sim_ms / 60000.0;
+  printf("meters: %u, %u baud, update interval %u s, %u simulated minutes\n", meters, baud_rate, interval_s, minutes);
+  printf("readouts: %.1f/min of %.1f/min asked for, %llu failed, %llu retries, %llu deadlines missed\n",
+         readouts / sim_min, meters * 60.0 / interval_s, (unsigned long long) failed, (unsigned long long) retries,
+         (unsigned long long) missed);
+  printf("bus: %.1f%% utilized, %u resets, %u selects, %u requests\n", 100.0 * bus->busy_us / (sim_ms * 1000.0),
+         bus->resets, bus->selects, bus->requests);
+  printf("host: %.3f s for %.1f simulated minutes, %.0fx real time\n", wall_s, sim_min, sim_ms / 1000.0 / wall_s);
+  return bus->master_errors ? 1 : 0;
+}
@@ -0,0 +1,295 @@
+#include "sim_bus.h"
+
+#include <algorithm>
+
+#include "esphome_test.h"
+
+namespace mbus_test {
+
+using namespace esphome;
+
+static const uint8_t ack = 0xE5;
+static const uint8_t garbled = 0xFF;
+
+uint64_t SimMeter::address() const {
+  return ((uint64_t) this->id << 32) | ((uint64_t) (this->manufacturer & 0xFF) << 24) |
+         ((uint64_t) (this->manufacturer >> 8) << 16) | ((uint64_t) this->version << 8) | this->medium;
+}
+
+void SimMeter::set_volume(uint32_t litres) {
+  this->frames = {{0x04, 0x13, (uint8_t) litres, (uint8_t) (litres >> 8), (uint8_t) (litres >> 16),
+                   (uint8_t) (litres >> 24)}};
+}
+
+//wildcards as in EN 13757-7: F per ID digit, FFFF manufacturer, FF version or medium
+static bool address_matches(uint64_t pattern, uint64_t address) {
+  for (int shift = 32; shift < 64; shift += 4) {
+    uint8_t digit = (pattern >> shift) & 0x0F;
+    if (digit != 0x0F && digit != ((address >> shift) & 0x0F)) return false;
+  }
+  if (((pattern >> 16) & 0xFFFF) != 0xFFFF && ((pattern ^ address) >> 16) & 0xFFFF) return false;
+  if (((pattern >> 8) & 0xFF) != 0xFF && ((pattern ^ address) >> 8) & 0xFF) return false;
+  if ((pattern & 0xFF) != 0xFF && (pattern ^ address) & 0xFF) return false;
+  return true;
+}
+
+static uint8_t checksum(const uint8_t *data, size_t len) {
+  uint8_t sum = 0;
+  for (size_t i = 0; i < len; i++) sum += data[i];
+  return sum;
+}
+
+SimBus::SimBus(uint32_t baud_rate, uint32_t seed) : base_baud_rate_(baud_rate), rng_(seed ? seed : 1) {
+  this->set_baud_rate(baud_rate);
+}
+
+SimMeter &SimBus::add_meter(uint32_t id) {
+  this->meters.emplace_back();
+  SimMeter &meter = this->meters.back();
+  meter.id = id;
+  meter.set_volume(0);
+  return meter;
+}
+
+uint64_t SimBus::now_us() const { return (uint64_t) test::now() * 1000; }
+
+uint32_t SimBus::byte_us() const { return 11000000 / this->get_baud_rate(); }
+
+double SimBus::random() {
+  this->rng_ ^= this->rng_ << 13;
+  this->rng_ ^= this->rng_ >> 17;
+  this->rng_ ^= this->rng_ << 5;
+  return (double) this->rng_ / 4294967296.0;
+}
+
+void SimBus::load_settings(bool /*dump_config*/) {
+  //bytes still underway were sent at the old rate and cannot be read at the new one
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  for (auto &byte : this->rx_) {
+    if (byte.first > this->now_us()) byte.second = garbled;
+  }
+}
+
+void SimBus::write_array(const uint8_t *data, size_t len) {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  uint64_t start = std::max(this->now_us(), this->tx_end_);
+  uint64_t end = start + (uint64_t) len * this->byte_us();
+  this->busy_us += end - start;
+  this->tx_end_ = end;
+  this->handle_frame(data, len, end);
+}
+
+void SimBus::handle_frame(const uint8_t *data, size_t len, uint64_t end) {
+  std::vector<std::pair<SimMeter *, std::vector<uint8_t>>> answers;
+  uint32_t baud_rate = this->get_baud_rate();
+  //meters only hear frames at the rate they are at
+  auto listening = [this, baud_rate](SimMeter &meter) {
+    return !meter.dead && (meter.baud_rate ? meter.baud_rate : this->base_baud_rate_) == baud_rate;
+  };
+  auto addressed = [](SimMeter &meter, uint8_t address) {
+    return (address == esphome::mbus::mbus_address_network_layer_) ? meter.selected : (meter.primary == address);
+  };
+
+  //short frame: SND_NKE or REQ_UD2
+  if (len == 5 && data[0] == 0x10) {
+    if (data[4] != 0x16 || data[3] != (uint8_t) (data[1] + data[2])) {
+      this->master_errors++;
+      return;
+    }
+    uint8_t control = data[1] & ~esphome::mbus::mbus_control_fcb_;
+    uint8_t address = data[2];
+    if (control == 0x40) {
+      this->resets++;
+      for (auto &meter : this->meters) {
+        if (!listening(meter)) continue;
+        if (address != 0xFF && address != 0xFD && meter.primary != address) continue;
+        meter.selected = false;
+        meter.fcb = -1;
+        meter.next_frame = 0;
+        meter.baud_rate = 0;
+        if (address != 0xFF && address != 0xFD) answers.push_back({&meter, {ack}});
+      }
+      this->answer(answers, end, false);
+      return;
+    }
+    if (control == 0x5B) {
+      this->requests++;
+      int fcb = (data[1] & esphome::mbus::mbus_control_fcb_) ? 1 : 0;
+      for (auto &meter : this->meters) {
+        if (!listening(meter) || !addressed(meter, address) || meter.frames.empty()) continue;
+        //toggled FCB: next frame, the same FCB again: the last frame once more
+        if (meter.fcb != fcb) {
+          meter.last_frame = meter.next_frame;
+          meter.next_frame = (meter.last_frame + 1) % meter.frames.size();
+          if (meter.last_frame == 0 && !meter.hold_access) meter.access++;
+          if (meter.last_frame == meter.frames.size() - 1) meter.readouts++;
+        }
+        meter.fcb = fcb;
+        meter.requests++;
+        answers.push_back({&meter, this->rsp_ud(&meter, meter.last_frame)});
+      }
+      this->answer(answers, end, true);
+      return;
+    }
+    this->master_errors++;
+    return;
+  }
+
+  //long frame: SND_UD
+  if (len < 9 || data[0] != 0x68 || data[3] != 0x68 || data[1] != data[2] || len != (size_t) data[1] + 6 ||
+      data[len - 1] != 0x16 || data[len - 2] != checksum(&data[4], data[1])) {
+    this->master_errors++;
+    return;
+  }
+  uint8_t address = data[5];
+  uint8_t ci = data[6];
+  int fcb = (data[4] & esphome::mbus::mbus_control_fcb_) ? 1 : 0;
+  if (ci == 0x52 && len == 17) {
+    this->selects++;
+    uint64_t pattern = ((uint64_t) data[10] << 56) | ((uint64_t) data[9] << 48) | ((uint64_t) data[8] << 40) |
+                       ((uint64_t) data[7] << 32) | ((uint64_t) data[11] << 24) | ((uint64_t) data[12] << 16) |
+                       ((uint64_t) data[13] << 8) | data[14];
+    for (auto &meter : this->meters) {
+      if (!listening(meter)) continue;
+      meter.selected = address_matches(pattern, meter.address());
+      if (meter.selected) answers.push_back({&meter, {ack}});
+    }
+    this->answer(answers, end, false);
+    return;
+  }
+  for (auto &meter : this->meters) {
+    if (!listening(meter) || !addressed(meter, address)) continue;
+    if (ci == esphome::mbus::mbus_ci_select_records_) {
+      if (!meter.selective) continue;
+      meter.selections++;
+    } else if (ci >= esphome::mbus::mbus_ci_baud_300_ && ci <= esphome::mbus::mbus_ci_baud_300_ + 7) {
+      uint32_t rate = esphome::mbus::mbus_baud_min_ << (ci - esphome::mbus::mbus_ci_baud_300_);
+      if (rate > meter.max_baud_rate && rate != this->base_baud_rate_) continue;
+      //acknowledged at the old rate, the meter switches afterwards
+      meter.baud_rate = (rate == this->base_baud_rate_) ? 0 : rate;
+    } else {
+      continue;
+    }
+    meter.fcb = fcb;
+    answers.push_back({&meter, {ack}});
+  }
+  this->answer(answers, end, false);
+}
+
+std::vector<uint8_t> SimBus::rsp_ud(SimMeter *meter, uint8_t frame) {
+  const std::vector<uint8_t> &records = meter->frames[frame];
+  bool more = frame + 1u < meter->frames.size();
+  uint8_t len = 3 + 12 + records.size() + (more ? 1 : 0);
+  std::vector<uint8_t> out = {0x68, len, len, 0x68, 0x08, meter->primary, 0x72};
+  for (int shift = 0; shift < 32; shift += 8) out.push_back(meter->id >> shift);
+  out.push_back(meter->manufacturer);
+  out.push_back(meter->manufacturer >> 8);
+  out.push_back(meter->version);
+  out.push_back(meter->medium);
+  out.push_back(meter->access);
+  out.push_back(0x00); //status
+  out.push_back(meter->config);
+  out.push_back(meter->config >> 8);
+  out.insert(out.end(), records.begin(), records.end());
+  if (more) out.push_back(0x1F);
+  out.push_back(checksum(&out[4], len));
+  out.push_back(0x16);
+  return out;
+}
+
+void SimBus::answer(std::vector<std::pair<SimMeter *, std::vector<uint8_t>>> &answers, uint64_t end, bool rsp_ud) {
+  if (answers.empty()) return;
+  uint32_t byte_us = this->byte_us();
+  if (answers.size() > 1) this->collisions++;
+
+  //each answer on its own: faults of the meter applied
+  std::vector<std::pair<uint64_t, std::vector<uint8_t>>> streams;
+  for (auto &answer : answers) {
+    std::vector<uint8_t> bytes = answer.second;
+    if (rsp_ud && this->random() < answer.first->corrupt_rate) bytes[bytes.size() - 2] ^= 0x5A;
+    if (rsp_ud && answer.first->drop_rate > 0) {
+      std::vector<uint8_t> kept;
+      for (uint8_t byte : bytes) {
+        if (this->random() >= answer.first->drop_rate) kept.push_back(byte);
+      }
+      bytes = kept;
+    }
+    streams.push_back({end + (uint64_t) answer.first->latency_ms * 1000, bytes});
+  }
+
+  //byte slots from the first answer on, overlapping bytes of different meters are garbled
+  uint64_t first = streams[0].first;
+  uint64_t last = 0;
+  for (auto &stream : streams) {
+    first = std::min(first, stream.first);
+    last = std::max(last, stream.first + (uint64_t) stream.second.size() * byte_us);
+  }
+  for (uint64_t slot = first; slot < last; slot += byte_us) {
+    int count = 0;
+    uint8_t byte = 0;
+    for (auto &stream : streams) {
+      if (slot + byte_us <= stream.first) continue;
+      uint64_t index = (slot + byte_us - 1 - stream.first) / byte_us;
+      if (index >= stream.second.size()) continue;
+      byte = stream.second[index];
+      count++;
+    }
+    if (!count) continue;
+    //receivable once the byte is complete
+    this->rx_.push_back({slot + byte_us, count > 1 ? garbled : byte});
+  }
+  this->busy_us += last - first;
+  this->tx_end_ = std::max(this->tx_end_, last);
+}
+
+int SimBus::available() {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  uint64_t now = this->now_us();
+  int n = 0;
+  for (auto &byte : this->rx_) {
+    if (byte.first > now) break;
+    n++;
+  }
+  return n;
+}
+
+bool SimBus::peek_byte(uint8_t *data) {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  if (this->rx_.empty() || this->rx_.front().first > this->now_us()) return false;
+  *data = this->rx_.front().second;
+  return true;
+}
+
+bool SimBus::read_array(uint8_t *data, size_t len) {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  uint64_t now = this->now_us();
+  if (this->rx_.size() < len || (len && this->rx_[len - 1].first > now)) return false;
+  for (size_t i = 0; i < len; i++) {
+    data[i] = this->rx_.front().second;
+    this->rx_.pop_front();
+  }
+  return true;
+}
+
+esphome::mbus::Mbus *sim_mbus(SimBus *bus, uint64_t secondary_address, uint32_t update_interval) {
+  auto *mbus = new esphome::mbus::Mbus();
+  mbus->set_uart_parent(bus);
+  mbus->set_secondary_address(secondary_address);
+  mbus->set_update_interval(update_interval);
+  mbus->set_clock(test::now);
+  return mbus;
+}
+
+void sim_record_table(esphome::mbus::Mbus *mbus, const std::vector<uint64_t> &vifs) {
+  std::vector<esphome::mbus::MbusRecordKey> sorted;
+  for (uint64_t vif : vifs) {
+    sorted.push_back({vif, 0, esphome::mbus::MbusPackRecordAttributes(0, 0, esphome::mbus::MBUS_INSTANT_VALUE)});
+  }
+  std::sort(sorted.begin(), sorted.end());
+  auto *keys = new esphome::mbus::MbusRecordKey[sorted.size()];
+  std::copy(sorted.begin(), sorted.end(), keys);
+  auto *slots = new esphome::mbus::MbusRecordSlot[sorted.size()]();
+  mbus->set_record_table(keys, slots, sorted.size());
+}
+
+}  // namespace mbus_test
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "esphome/components/uart/uart.h"
+#include "esphome/components/mbus/mbus.h"
+
+namespace mbus_test {
+
+/* A meter on the simulated bus, answering as EN 13757-2/-3 describes:
+ * ACK to select, SND_NKE, selection of records and baud rate switch, RSP_UD
+ * with a long frame to REQ_UD2, the next frame of a multi-frame readout
+ * once the FCB toggles.
+ * */
+struct SimMeter {
+  //identity, sent in the header of each RSP_UD
+  uint32_t id{0}; //8 BCD digits
+  uint16_t manufacturer{0x2C2D};
+  uint8_t version{0x01};
+  uint8_t medium{0x07};
+  uint8_t primary{0xFB};
+  uint16_t config{0}; //configuration field, e.g. security mode 5
+  //data records of each frame of a readout, after the fixed header; "more frames follow" is added
+  std::vector<std::vector<uint8_t>> frames;
+
+  //faults
+  uint32_t latency_ms{30}; //from the end of a request to the first byte of the answer
+  bool dead{false};
+  double drop_rate{0}; //probability of each byte of a RSP_UD being lost
+  double corrupt_rate{0}; //probability of a RSP_UD with a wrong checksum
+  bool selective{false}; //acknowledges the selection of records for readout
+  uint32_t max_baud_rate{0}; //acknowledges switching up to this rate, none if 0
+  bool hold_access{false}; //keep the access number, for canned encrypted frames
+
+  //state, as the meter sees it
+  bool selected{false};
+  uint8_t access{0};
+  int fcb{-1}; //-1 after reset
+  uint8_t next_frame{0};
+  uint8_t last_frame{0};
+  uint32_t baud_rate{0}; //0: base rate of the bus
+
+  //counters
+  uint32_t requests{0}; //REQ_UD2 answered
+  uint32_t readouts{0}; //last frame of a readout sent
+  uint32_t selections{0}; //selection of records acknowledged
+
+  //secondary address as the mbus component writes it
+  uint64_t address() const;
+  //single frame with one 32 bit volume record (VIF 0x13, litres)
+  void set_volume(uint32_t litres);
+};
+
+/* Half-duplex bus of simulated meters behind the uart of the mbus component,
+ * on the simulated time of the test harness: every byte takes 11 bit times
+ * at the current baud rate, meters answer after their latency. Answers of
+ * several meters at once collide, the master reads 0xFF for every byte
+ * they overlap. Master frames are checked, a malformed one is counted.
+ *
+ * The uart methods may be called from another thread than the one
+ * advancing time, as the RX task does.
+ * */
+class SimBus : public esphome::uart::UARTComponent {
+ public:
+  explicit SimBus(uint32_t baud_rate = 2400, uint32_t seed = 1);
+
+  //meters stay where they are, references remain valid
+  SimMeter &add_meter(uint32_t id);
+  std::deque<SimMeter> meters;
+
+  //counters
+  uint32_t resets{0};
+  uint32_t selects{0};
+  uint32_t requests{0};
+  uint32_t collisions{0};
+  uint32_t master_errors{0}; //frames with wrong checksum or framing from the master
+  uint64_t busy_us{0}; //time bytes were on the bus, both directions
+
+  void write_array(const uint8_t *data, size_t len) override;
+  bool peek_byte(uint8_t *data) override;
+  bool read_array(uint8_t *data, size_t len) override;
+  int available() override;
+  void flush() override {}
+  void load_settings(bool dump_config) override;
+
+ protected:
+  uint64_t now_us() const;
+  uint32_t byte_us() const;
+  double random();
+  void handle_frame(const uint8_t *data, size_t len, uint64_t end);
+  void answer(std::vector<std::pair<SimMeter *, std::vector<uint8_t>>> &answers, uint64_t end, bool rsp_ud);
+  std::vector<uint8_t> rsp_ud(SimMeter *meter, uint8_t frame);
+
+  std::mutex mutex_;
+  std::deque<std::pair<uint64_t, uint8_t>> rx_; //byte, receivable from that time (us)
+  uint64_t tx_end_{0}; //bus busy until
+  uint32_t base_baud_rate_;
+  uint32_t rng_;
+};
+
+//Mbus instance reading secondary_address on bus, on simulated time; setup() is left to the test
+esphome::mbus::Mbus *sim_mbus(SimBus *bus, uint64_t secondary_address, uint32_t update_interval);
+//key table and slots for the given VIFs, storage 0, tariff 0, subunit 0, sorted as the sensor platform does
+void sim_record_table(esphome::mbus::Mbus *mbus, const std::vector<uint64_t> &vifs);
+
+}  // namespace mbus_test
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace esphome {
+namespace binary_sensor {
+
+class BinarySensor {
+ public:
+  void set_name(const std::string &name) { this->name_ = name; }
+  const std::string &get_name() const { return this->name_; }
+  void publish_state(bool state) {
+    this->state = state;
+    this->publish_count++;
+  }
+  void publish_initial_state(bool state) { this->publish_state(state); }
+
+  bool state{false};
+  uint32_t publish_count{0};
+
+ protected:
+  std::string name_;
+};
+
+}  // namespace binary_sensor
+}  // namespace esphome
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace sensor {
+
+//keeps what was published, for the tests to look at
+class Sensor {
+ public:
+  void set_name(const std::string &name) { this->name_ = name; }
+  const std::string &get_name() const { return this->name_; }
+  uint32_t get_object_id_hash() const { return fnv1_hash(this->name_); }
+  void publish_state(float state) {
+    this->state = state;
+    this->publish_count++;
+  }
+  bool has_state() const { return this->publish_count != 0; }
+
+  float state{NAN};
+  uint32_t publish_count{0};
+
+ protected:
+  std::string name_;
+};
+
+}  // namespace sensor
+}  // namespace esphome
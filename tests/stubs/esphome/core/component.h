@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "esphome/core/hal.h"
+
+namespace esphome {
+
+namespace setup_priority {
+const float BUS = 1000.0f;
+const float IO = 900.0f;
+const float HARDWARE = 800.0f;
+const float DATA = 600.0f;
+}  // namespace setup_priority
+
+/* Enough of the ESPHome component to run the mbus component on the host:
+ * timeouts and intervals go to the scheduler of the test harness, which
+ * runs on simulated time (see esphome_test.h), allocating per item like
+ * the real one.
+ * */
+class Component {
+ public:
+  virtual ~Component();
+  virtual void setup() {}
+  virtual void loop() {}
+  virtual void dump_config() {}
+  virtual void on_safe_shutdown() {}
+  virtual float get_setup_priority() const { return 0.0f; }
+  virtual void call_setup() { this->setup(); }
+
+  void mark_failed() { this->failed_ = true; }
+  bool is_failed() const { return this->failed_; }
+
+ protected:
+  void set_interval(const std::string &name, uint32_t interval, std::function<void()> &&f);
+  void set_interval(uint32_t interval, std::function<void()> &&f) { this->set_interval("", interval, std::move(f)); }
+  bool cancel_interval(const std::string &name);
+  void set_timeout(const std::string &name, uint32_t timeout, std::function<void()> &&f);
+  void set_timeout(uint32_t timeout, std::function<void()> &&f) { this->set_timeout("", timeout, std::move(f)); }
+  bool cancel_timeout(const std::string &name);
+  void defer(std::function<void()> &&f) { this->set_timeout("", 0, std::move(f)); }
+  void status_set_warning() {}
+  void status_clear_warning() {}
+
+  bool failed_{false};
+};
+
+class PollingComponent : public Component {
+ public:
+  PollingComponent() = default;
+  explicit PollingComponent(uint32_t update_interval) : update_interval_(update_interval) {}
+
+  virtual void update() = 0;
+  //as in ESPHome: the poller is started before setup(), which may stop it again
+  void call_setup() override {
+    this->start_poller();
+    this->setup();
+  }
+  virtual void set_update_interval(uint32_t update_interval) { this->update_interval_ = update_interval; }
+  virtual uint32_t get_update_interval() const { return this->update_interval_; }
+  void start_poller() { this->set_interval("update", this->get_update_interval(), [this]() { this->update(); }); }
+  void stop_poller() { this->cancel_interval("update"); }
+
+ protected:
+  uint32_t update_interval_{60000};
+};
+
+}  // namespace esphome
@@ -0,0 +1,3 @@
+#pragma once
+
+// USE_BINARY_SENSOR and MBUS_RX_TASK are passed by tests/CMakeLists.txt
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "esphome/core/preferences.h"
+
+/* Control of the host stubs of ESPHome: simulated time with the scheduler
+ * running on it, preferences with a limited size as on the ESP8266, and
+ * the log.
+ * */
+namespace esphome {
+namespace test {
+
+//simulated time in ms, the clock to pass to Mbus::set_clock()
+uint32_t now();
+//advance simulated time by ms, 1 ms at a time, running the timeouts and intervals due
+void advance(uint32_t ms);
+//advance simulated time by ms with the main loop held up: tasks run, timeouts and intervals do not
+void stall(uint32_t ms);
+//run until done() or ms have passed, returns whether done() became true
+bool advance_until(uint32_t ms, bool (*done)(void *), void *arg);
+//seed of the random phase of intervals, as the scheduler of ESPHome gives them
+void seed(uint32_t seed);
+//cancel the timeouts and intervals of all components so far: instances of earlier tests stand still
+void stop_components();
+//FreeRTOS tasks: calls of vTaskDelay() and ulTaskNotifyTake() so far, of all tasks
+uint32_t task_delays();
+uint32_t task_notify_takes();
+
+/* Preferences kept in memory. Each preference takes its size in words
+ * plus one, as in the flash of the ESP8266; once budget_words are used up,
+ * make_preference() returns an object that neither saves nor loads.
+ * */
+class TestPreferences : public ESPPreferences {
+ public:
+  ESPPreferenceObject make_preference(size_t length, uint32_t type, bool in_flash) override;
+  bool sync() override { return true; }
+  //0: unlimited
+  void set_budget(uint32_t words) { this->budget_words_ = words; }
+  uint32_t used_words() const { return this->used_words_; }
+  //forget the preferences made, keep what was saved, as a reboot does
+  void reboot() { this->used_words_ = 0; }
+  //forget everything saved
+  void erase() {
+    this->reboot();
+    this->data_.clear();
+  }
+
+ protected:
+  class Backend : public ESPPreferenceBackend {
+   public:
+    Backend(std::vector<uint8_t> *data) : data_(data) {}
+    bool save(const uint8_t *data, size_t len) override;
+    bool load(uint8_t *data, size_t len) override;
+
+   protected:
+    std::vector<uint8_t> *data_;
+  };
+  std::map<uint32_t, std::vector<uint8_t>> data_;
+  std::vector<Backend *> backends_;
+  uint32_t budget_words_{0};
+  uint32_t used_words_{0};
+};
+TestPreferences &preferences();
+
+//print log lines as well, they are only counted otherwise
+void log_echo(bool echo);
+uint32_t log_count(int level);
+//whether any of the last lines logged, or of the last warnings and errors, contains text
+bool log_contains(const char *text);
+void log_clear();
+
+}  // namespace test
+}  // namespace esphome
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+/* Tasks on the host: a thread each, ticking with the simulated time of the
+ * scheduler (1 ms per tick). Each tick of test::advance() waits until every
+ * task is blocked, in vTaskDelay() or ulTaskNotifyTake(), as a task of
+ * higher priority than the main loop would be by then.
+ * */
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_depth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle);
+void vTaskDelay(TickType_t ticks);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
@@ -0,0 +1,344 @@
+#include "esphome_test.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "esphome/core/component.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+#include "freertos/task.h"
+
+namespace esphome {
+
+/* host clock */
+
+static const auto boot = std::chrono::steady_clock::now();
+
+uint32_t millis() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - boot).count();
+}
+uint32_t micros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - boot).count();
+}
+void delay(uint32_t ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+
+/* scheduler on simulated time */
+
+namespace {
+
+struct SchedulerItem {
+  Component *component;
+  std::string name;
+  bool interval;
+  uint32_t period;
+  uint32_t next;
+  std::function<void()> f;
+  bool removed;
+};
+
+struct Scheduler {
+  std::vector<SchedulerItem *> items;
+  std::atomic<uint32_t> now{0}; //read by the RX task of the bus as well
+  uint32_t rng{1};
+
+  //xorshift32, deterministic for a given seed
+  uint32_t random() {
+    this->rng ^= this->rng << 13;
+    this->rng ^= this->rng >> 17;
+    this->rng ^= this->rng << 5;
+    return this->rng;
+  }
+  bool cancel(Component *component, const std::string &name, bool interval) {
+    bool found = false;
+    for (auto *item : this->items) {
+      if (item->removed || item->component != component || item->interval != interval || item->name != name) continue;
+      item->removed = true;
+      found = true;
+    }
+    return found;
+  }
+  void add(Component *component, const std::string &name, bool interval, uint32_t period, uint32_t delay,
+           std::function<void()> &&f) {
+    if (!name.empty()) this->cancel(component, name, interval);
+    this->items.push_back(new SchedulerItem{component, name, interval, period, this->now + delay, std::move(f), false});
+  }
+  //run the items due, earliest first, those added meanwhile as well if due
+  void run() {
+    for (;;) {
+      SchedulerItem *due = nullptr;
+      for (auto *item : this->items) {
+        if (item->removed || (int32_t) (this->now - item->next) < 0) continue;
+        if (due == nullptr || (int32_t) (item->next - due->next) < 0) due = item;
+      }
+      if (due == nullptr) break;
+      if (due->interval) {
+        due->next += due->period ? due->period : 1;
+      } else {
+        due->removed = true;
+      }
+      due->f();
+    }
+    for (size_t i = 0; i < this->items.size();) {
+      if (this->items[i]->removed) {
+        delete this->items[i];
+        this->items.erase(this->items.begin() + i);
+      } else {
+        i++;
+      }
+    }
+  }
+};
+
+Scheduler &scheduler() {
+  static Scheduler instance;
+  return instance;
+}
+
+}  // namespace
+
+Component::~Component() {
+  for (auto *item : scheduler().items) {
+    if (item->component == this) item->removed = true;
+  }
+}
+
+//as in ESPHome, an interval first runs at a random offset of up to half its period, 5 s at most
+void Component::set_interval(const std::string &name, uint32_t interval, std::function<void()> &&f) {
+  uint32_t max_offset = std::min<uint32_t>(interval / 2, 5000);
+  uint32_t offset = max_offset ? scheduler().random() % (max_offset + 1) : 0;
+  scheduler().add(this, name, true, interval, offset, std::move(f));
+}
+bool Component::cancel_interval(const std::string &name) { return scheduler().cancel(this, name, true); }
+void Component::set_timeout(const std::string &name, uint32_t timeout, std::function<void()> &&f) {
+  scheduler().add(this, name, false, 0, timeout, std::move(f));
+}
+bool Component::cancel_timeout(const std::string &name) { return scheduler().cancel(this, name, false); }
+
+/* preferences */
+
+static test::TestPreferences test_preferences;
+ESPPreferences *global_preferences = &test_preferences;
+
+/* log: formatted on the stack and kept in rings of lines, warnings and errors
+ * in one of their own so that they are not pushed out by debug lines, without
+ * allocating */
+
+static const int log_lines = 64;
+static const int log_line_len = 192;
+static char log_ring[2][log_lines][log_line_len];
+static int log_next[2] = {0, 0};
+static uint32_t log_counts[ESPHOME_LOG_LEVEL_VERY_VERBOSE + 1];
+static bool log_echo_enabled = false;
+
+void esp_log_printf_(int level, const char *tag, int line, const char *format, ...) {
+  int ring = (level <= ESPHOME_LOG_LEVEL_WARN) ? 1 : 0;
+  char *out = log_ring[ring][log_next[ring]];
+  log_next[ring] = (log_next[ring] + 1) % log_lines;
+  int n = snprintf(out, log_line_len, "[%s:%d] ", tag, line);
+  va_list args;
+  va_start(args, format);
+  vsnprintf(out + n, log_line_len - n, format, args);
+  va_end(args);
+  if (level >= 0 && level <= ESPHOME_LOG_LEVEL_VERY_VERBOSE) log_counts[level]++;
+  if (log_echo_enabled) printf("%6u %s\n", scheduler().now.load(), out);
+}
+
+/* tasks on simulated time */
+
+namespace {
+
+struct Kernel {
+  std::mutex mutex;
+  std::condition_variable blocked_changed;
+  std::vector<HostTask *> tasks;
+  uint32_t delays{0};
+  uint32_t notify_takes{0};
+};
+
+Kernel &kernel() {
+  static Kernel instance;
+  return instance;
+}
+
+thread_local HostTask *current_task = nullptr;
+
+}  // namespace
+
+}  // namespace esphome
+
+struct HostTask {
+  std::condition_variable wake;
+  bool blocked{false};
+  bool delayed{false}; //woken at wake_at
+  bool notify_wait{false}; //woken by a notification
+  uint32_t wake_at{0};
+  uint32_t notifications{0};
+};
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char * /*name*/, uint32_t /*stack_depth*/, void *arg,
+                       UBaseType_t /*priority*/, TaskHandle_t *handle) {
+  auto &kernel = esphome::kernel();
+  auto *task = new HostTask();
+  {
+    std::lock_guard<std::mutex> lock(kernel.mutex);
+    kernel.tasks.push_back(task);
+  }
+  if (handle) *handle = task;
+  //runs until the process ends, which has to _exit() then
+  std::thread([task, function, arg]() {
+    esphome::current_task = task;
+    function(arg);
+  }).detach();
+  return pdPASS;
+}
+
+void vTaskDelay(TickType_t ticks) {
+  auto &kernel = esphome::kernel();
+  HostTask *task = esphome::current_task;
+  std::unique_lock<std::mutex> lock(kernel.mutex);
+  kernel.delays++;
+  task->wake_at = esphome::scheduler().now + (ticks ? ticks : 1);
+  task->delayed = true;
+  task->blocked = true;
+  kernel.blocked_changed.notify_all();
+  task->wake.wait(lock, [task]() { return !task->blocked; });
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait) {
+  auto &kernel = esphome::kernel();
+  HostTask *task = esphome::current_task;
+  std::unique_lock<std::mutex> lock(kernel.mutex);
+  kernel.notify_takes++;
+  if (!task->notifications && ticks_to_wait) {
+    task->delayed = ticks_to_wait != portMAX_DELAY;
+    task->wake_at = esphome::scheduler().now + ticks_to_wait;
+    task->notify_wait = true;
+    task->blocked = true;
+    kernel.blocked_changed.notify_all();
+    task->wake.wait(lock, [task]() { return !task->blocked; });
+    task->notify_wait = false;
+  }
+  uint32_t notifications = task->notifications;
+  if (notifications) task->notifications = clear_on_exit ? 0 : notifications - 1;
+  return notifications;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  std::lock_guard<std::mutex> lock(esphome::kernel().mutex);
+  task->notifications++;
+  if (task->blocked && task->notify_wait) {
+    task->blocked = false;
+    task->wake.notify_one();
+  }
+  return pdPASS;
+}
+
+namespace esphome {
+
+//wake the tasks whose delay is over, and wait until all tasks are blocked again
+static void kernel_tick() {
+  auto &kernel = esphome::kernel();
+  std::unique_lock<std::mutex> lock(kernel.mutex);
+  if (kernel.tasks.empty()) return;
+  uint32_t now = scheduler().now;
+  for (auto *task : kernel.tasks) {
+    if (task->blocked && task->delayed && (int32_t) (now - task->wake_at) >= 0) {
+      task->blocked = false;
+      task->wake.notify_one();
+    }
+  }
+  kernel.blocked_changed.wait(lock, [&kernel]() {
+    return std::all_of(kernel.tasks.begin(), kernel.tasks.end(), [](HostTask *task) { return task->blocked; });
+  });
+}
+
+namespace test {
+
+uint32_t now() { return scheduler().now; }
+
+void advance(uint32_t ms) {
+  for (uint32_t i = 0; i < ms; i++) {
+    scheduler().now++;
+    kernel_tick();
+    scheduler().run();
+  }
+}
+
+void stall(uint32_t ms) {
+  for (uint32_t i = 0; i < ms; i++) {
+    scheduler().now++;
+    kernel_tick();
+  }
+}
+
+uint32_t task_delays() {
+  std::lock_guard<std::mutex> lock(kernel().mutex);
+  return kernel().delays;
+}
+uint32_t task_notify_takes() {
+  std::lock_guard<std::mutex> lock(kernel().mutex);
+  return kernel().notify_takes;
+}
+
+bool advance_until(uint32_t ms, bool (*done)(void *), void *arg) {
+  for (uint32_t i = 0; i < ms; i++) {
+    if (done(arg)) return true;
+    advance(1);
+  }
+  return done(arg);
+}
+
+void seed(uint32_t seed) { scheduler().rng = seed ? seed : 1; }
+
+void stop_components() {
+  for (auto *item : scheduler().items) item->removed = true;
+}
+
+ESPPreferenceObject TestPreferences::make_preference(size_t length, uint32_t type, bool /*in_flash*/) {
+  uint32_t words = (length + 3) / 4 + 1;
+  if (this->budget_words_ && this->used_words_ + words > this->budget_words_) return {};
+  this->used_words_ += words;
+  //backends live as long as the process, as in ESPHome
+  auto *backend = new Backend(&(this->data_[type]));
+  this->backends_.push_back(backend);
+  return ESPPreferenceObject(backend);
+}
+
+bool TestPreferences::Backend::save(const uint8_t *data, size_t len) {
+  //assign() reuses the storage once it is large enough
+  this->data_->assign(data, data + len);
+  return true;
+}
+
+bool TestPreferences::Backend::load(uint8_t *data, size_t len) {
+  if (this->data_->size() != len) return false;
+  memcpy(data, this->data_->data(), len);
+  return true;
+}
+
+TestPreferences &preferences() { return test_preferences; }
+
+void log_echo(bool echo) { log_echo_enabled = echo; }
+uint32_t log_count(int level) { return log_counts[level]; }
+bool log_contains(const char *text) {
+  for (int ring = 0; ring < 2; ring++) {
+    for (int i = 0; i < log_lines; i++) {
+      if (strstr(log_ring[ring][i], text)) return true;
+    }
+  }
+  return false;
+}
+void log_clear() {
+  memset(log_ring, 0, sizeof(log_ring));
+  memset(log_counts, 0, sizeof(log_counts));
+}
+
+}  // namespace test
+}  // namespace esphome
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdio>
+
+/* Minimal checks for the host tests: a failed CHECK is reported and the
+ * test goes on, TEST_RESULT() is the exit code of main().
+ * */
+static int test_failures = 0;
+
+#define CHECK(cond) \
+  do { \
+    if (!(cond)) { \
+      printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+      test_failures++; \
+    } \
+  } while (0)
+
+#define CHECK_EQ(a, b) \
+  do { \
+    long long check_a_ = (long long) (a), check_b_ = (long long) (b); \
+    if (check_a_ != check_b_) { \
+      printf("%s:%d: CHECK failed: %s == %s (%lld != %lld)\n", __FILE__, __LINE__, #a, #b, check_a_, check_b_); \
+      test_failures++; \
+    } \
+  } while (0)
+
+#define TEST_RESULT() \
+  (printf("%s\n", test_failures ? "FAILED" : "OK"), test_failures ? 1 : 0)
@@ -0,0 +1,100 @@
+/* AES-128-CBC decryption of security mode 5 telegrams, as on the ESP32
+ * (mbedtls), or as on the ESP8266 (BearSSL) when built as test_aes_bearssl:
+ * a known-answer test of MbusAes::decrypt_cbc(), and a telegram encrypted
+ * with the initialization vector of EN 13757-7 read over the simulated bus.
+ * */
+#include "esphome_test.h"
+#include "sim_bus.h"
+#include "test.h"
+
+#include <cstring>
+
+using namespace esphome;
+using namespace esphome::mbus;
+using namespace mbus_test;
+
+//NIST SP 800-38A, F.2.2 CBC-AES128.Decrypt
+static const uint8_t nist_key[16] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+                                     0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+static const uint8_t nist_iv[16] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+                                    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+static const uint8_t nist_ciphertext[64] = {
+    0x76, 0x49, 0xab, 0xac, 0x81, 0x19, 0xb2, 0x46, 0xce, 0xe9, 0x8e, 0x9b, 0x12, 0xe9, 0x19, 0x7d,
+    0x50, 0x86, 0xcb, 0x9b, 0x50, 0x72, 0x19, 0xee, 0x95, 0xdb, 0x11, 0x3a, 0x91, 0x76, 0x78, 0xb2,
+    0x73, 0xbe, 0xd6, 0xb8, 0xe3, 0xc1, 0x74, 0x3b, 0x71, 0x16, 0xe6, 0x9e, 0x22, 0x22, 0x95, 0x16,
+    0x3f, 0xf1, 0xca, 0xa1, 0x68, 0x1f, 0xac, 0x09, 0x12, 0x0e, 0xca, 0x30, 0x75, 0x86, 0xe1, 0xa7};
+static const uint8_t nist_plaintext[64] = {
+    0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+    0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+    0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+    0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10};
+
+static void test_known_answer() {
+  MbusAes aes;
+  CHECK(!aes.has_key());
+  CHECK(aes.set_key(nist_key));
+  uint8_t iv[16];
+  uint8_t data[64];
+  memcpy(iv, nist_iv, sizeof(iv));
+  memcpy(data, nist_ciphertext, sizeof(data));
+  //in place, as the telegram buffer is decrypted
+  CHECK(aes.decrypt_cbc(iv, data, sizeof(data)));
+  CHECK(!memcmp(data, nist_plaintext, sizeof(data)));
+
+  //block by block, the iv carrying the chain over
+  memcpy(iv, nist_iv, sizeof(iv));
+  memcpy(data, nist_ciphertext, sizeof(data));
+  for (uint16_t pos = 0; pos < sizeof(data); pos += MBUS_AES_BLOCK_LEN) CHECK(aes.decrypt_cbc(iv, &data[pos], 16));
+  CHECK(!memcmp(data, nist_plaintext, sizeof(data)));
+
+  //only whole blocks
+  CHECK(!aes.decrypt_cbc(iv, data, 15));
+}
+
+/* 2F 2F, volume 1000 l, flow temperature 42 °C, 2F fill; encrypted with key
+ * 000102...0F and the iv of meter 12345678, manufacturer 0x2C2D, version 1,
+ * medium 7, access number 0x5A:
+ * 2D 2C 78 56 34 12 01 07 5A 5A 5A 5A 5A 5A 5A 5A
+ * */
+static const std::vector<uint8_t> encrypted_records = {0x8a, 0x81, 0xdb, 0x4c, 0xed, 0x94, 0x5b, 0xbd,
+                                                       0xe6, 0x4c, 0x32, 0x12, 0x03, 0x5a, 0x62, 0x19};
+
+static Mbus *encrypted_meter(const char *key) {
+  SimBus *bus = new SimBus();
+  SimMeter &meter = bus->add_meter(0x12345678);
+  meter.frames = {encrypted_records};
+  meter.config = 0x0510; //security mode 5, one encrypted block
+  meter.access = 0x5A;
+  meter.hold_access = true;
+  Mbus *mbus = sim_mbus(bus, meter.address(), 10000);
+  mbus->set_aes_key(key);
+  sim_record_table(mbus, {0x13, 0x5B});
+  mbus->call_setup();
+  return mbus;
+}
+
+static void test_frame_iv() {
+  Mbus *mbus = encrypted_meter("000102030405060708090A0B0C0D0E0F");
+  test::advance(15000);
+  CHECK(mbus->telegram_count > 0);
+  const struct MbusRecordSlot *volume = mbus->get_record_slot(0);
+  const struct MbusRecordSlot *temperature = mbus->get_record_slot(1);
+  CHECK(volume->match_count == 1 && volume->has_value);
+  CHECK_EQ(volume->value.integer, 1000);
+  CHECK(temperature->match_count == 1 && temperature->has_value);
+  CHECK_EQ(temperature->value.integer, 42);
+
+  //a wrong key does not decrypt to 2F 2F
+  test::log_clear();
+  Mbus *wrong = encrypted_meter("0F0E0D0C0B0A09080706050403020100");
+  test::advance(15000);
+  CHECK_EQ(wrong->telegram_count, 0);
+  CHECK(test::log_contains("Decryption failed"));
+}
+
+int main() {
+  test::seed(1);
+  test_known_answer();
+  test_frame_iv();
+  return TEST_RESULT();
+}
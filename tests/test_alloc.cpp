@@ -0,0 +1,159 @@
+/* Heap allocations of decoding and publishing: none once running. operator
+ * new is counted while MbusParseVariablePayload() decodes a telegram, and
+ * over whole polls, from update() (or the tick of update_offset) through
+ * the readout until the sensors have published and saved it, scheduler
+ * included. The meter is a uart that replays it from fixed buffers, as the
+ * simulated bus allocates itself.
+ * */
+#include "esphome_test.h"
+#include "sim_bus.h"
+#include "test.h"
+
+#include "esphome/components/mbus/sensor/mbus_sensor.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+using namespace esphome;
+using namespace esphome::mbus;
+using namespace mbus_test;
+
+static std::atomic<uint64_t> allocations{0};
+static std::atomic<bool> counting{false};
+
+void *operator new(size_t size) {
+  if (counting) allocations++;
+  void *p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+//secondary address 12345678, manufacturer 0x2C2D, version 1, water; volume and flow temperature
+static const uint8_t rsp_ud[] = {0x68, 0x19, 0x19, 0x68, 0x08, 0xFD, 0x72, 0x78, 0x56, 0x34, 0x12, 0x2D,
+                                 0x2C, 0x01, 0x07, 0x00, 0x00, 0x00, 0x00, 0x04, 0x13, 0x00, 0x00, 0x00,
+                                 0x00, 0x02, 0x5B, 0x2A, 0x00, 0x00, 0x16};
+static const uint16_t rsp_ud_access = 15;
+static const uint16_t rsp_ud_volume = 21;
+
+/* A single meter answering from a fixed buffer: ACK to addressed frames,
+ * RSP_UD to REQ_UD2 with the access number and volume counting up, nothing
+ * to broadcasts.
+ * */
+class ReplayUart : public uart::UARTComponent {
+ public:
+  ReplayUart() { memcpy(this->tg_, rsp_ud, sizeof(rsp_ud)); }
+  void write_array(const uint8_t *data, size_t len) override {
+    this->len_ = this->pos_ = 0;
+    if (len == 5 && data[0] == 0x10 && (data[1] & 0x4F) == 0x4B) {
+      this->tg_[rsp_ud_access]++;
+      this->tg_[rsp_ud_volume]++;
+      uint8_t checksum = 0;
+      for (uint16_t i = 4; i < sizeof(rsp_ud) - 2; i++) checksum += this->tg_[i];
+      this->tg_[sizeof(rsp_ud) - 2] = checksum;
+      memcpy(this->rx_, this->tg_, sizeof(rsp_ud));
+      this->len_ = sizeof(rsp_ud);
+      this->requests++;
+    } else if (!(len == 5 && (data[2] == 0xFD || data[2] == 0xFF))) {
+      this->rx_[0] = 0xE5;
+      this->len_ = 1;
+    }
+  }
+  bool peek_byte(uint8_t *data) override {
+    if (this->pos_ >= this->len_) return false;
+    *data = this->rx_[this->pos_];
+    return true;
+  }
+  bool read_array(uint8_t *data, size_t len) override {
+    if (this->len_ - this->pos_ < len) return false;
+    memcpy(data, &(this->rx_[this->pos_]), len);
+    this->pos_ += len;
+    return true;
+  }
+  int available() override { return this->len_ - this->pos_; }
+  void flush() override {}
+
+  uint32_t requests{0};
+
+ protected:
+  uint8_t tg_[sizeof(rsp_ud)];
+  uint8_t rx_[sizeof(rsp_ud)];
+  uint16_t len_{0};
+  uint16_t pos_{0};
+};
+
+static void test_parse() {
+  MbusRecordKey keys[] = {{0x13, 0, MbusPackRecordAttributes(0, 0, MBUS_INSTANT_VALUE)},
+                          {0x5B, 0, MbusPackRecordAttributes(0, 0, MBUS_INSTANT_VALUE)}};
+  MbusRecordSlot slots[2] = {};
+  uint16_t end = rsp_ud[1] + 3;
+  allocations = 0;
+  counting = true;
+  for (uint16_t avail = 20; avail <= sizeof(rsp_ud); avail++) {
+    //whole, and as the bytes arrive
+    for (uint16_t from : {(uint16_t) 20, avail}) {
+      uint16_t pos = 19;
+      uint8_t records = 0;
+      for (auto &slot : slots) slot.pending_count = 0;
+      for (uint16_t step = from; step <= avail; step++) {
+        MbusParseVariablePayload(rsp_ud, &pos, step, end, keys, slots, 2, &records, "alloc");
+      }
+    }
+  }
+  counting = false;
+  CHECK_EQ(slots[0].pending_count, 1);
+  CHECK_EQ(slots[1].pending_count, 1);
+  CHECK_EQ(allocations.load(), 0);
+}
+
+static void test_publish(uint32_t update_offset) {
+  ReplayUart *uart = new ReplayUart();
+  Mbus *mbus = new Mbus();
+  mbus->set_uart_parent(uart);
+  mbus->set_secondary_address(0x123456782D2C0107);
+  mbus->set_update_interval(1000);
+  mbus->set_update_offset(update_offset);
+  mbus->set_clock(test::now);
+  sim_record_table(mbus, {0x13, 0x5B});
+  MbusSensor *sensors[2];
+  for (uint16_t i = 0; i < 2; i++) {
+    sensors[i] = new MbusSensor();
+    sensors[i]->set_name(i ? "temperature" : "volume");
+    sensors[i]->set_parent(mbus);
+    sensors[i]->set_mbus_vife(i ? 0x5B : 0x13);
+    sensors[i]->set_record_index(i);
+    sensors[i]->set_restore_value(true);
+  }
+  mbus->call_setup();
+  for (auto *sensor : sensors) sensor->call_setup();
+  //called after the sensors have published
+  uint32_t telegrams = 0;
+  mbus->add_on_telegram_callback([&telegrams](bool) { telegrams++; });
+
+  //log rings and saved preferences have their storage after the first readouts
+  test::advance(15 * 60000);
+  CHECK(telegrams >= 100);
+  allocations = 0;
+  uint32_t before = telegrams;
+  uint32_t requests = uart->requests;
+  uint32_t publishes = sensors[0]->publish_count;
+  counting = true;
+  test::advance(15 * 60000);
+  counting = false;
+  CHECK(telegrams - before >= 100);
+  //every poll read and published
+  CHECK_EQ(sensors[0]->publish_count - publishes, uart->requests - requests);
+  CHECK(uart->requests - requests >= 15 * 60 - 1);
+  CHECK_EQ(allocations.load(), 0);
+}
+
+int main() {
+  test::seed(1);
+  test_parse();
+  test_publish(0);
+  test_publish(250);
+  return TEST_RESULT();
+}
@@ -0,0 +1,175 @@
+/* Receiving in a task of its own (rx_task): the queue between two threads,
+ * and readouts over the simulated bus with the component built with
+ * MBUS_RX_TASK, its task running as a thread on simulated time.
+ * */
+#include "esphome_test.h"
+#include "sim_bus.h"
+#include "test.h"
+
+#include "esphome/components/mbus/mbus_spsc.h"
+
+#include <cstdio>
+#include <thread>
+#include <unistd.h>
+
+using namespace esphome;
+using namespace esphome::mbus;
+using namespace mbus_test;
+
+static const uint64_t vif_volume = 0x13;
+
+static uint32_t volume_of(Mbus *mbus) {
+  const struct MbusRecordSlot *slot = mbus->get_record_slot(0);
+  return (slot->match_count == 1 && slot->has_value) ? (uint32_t) slot->value.integer : 0xFFFFFFFF;
+}
+
+//a producer and a consumer thread, in chunks of changing size: every byte arrives once, in order
+static void test_queue_threads() {
+  static MbusSpscQueue<1024> queue;
+  const uint32_t total = 4000000;
+  std::thread producer([&]() {
+    uint8_t chunk[97];
+    uint32_t sent = 0;
+    for (uint16_t len = 1; sent < total; len = len % 97 + 1) {
+      uint16_t n = (total - sent < len) ? total - sent : len;
+      for (uint16_t i = 0; i < n; i++) chunk[i] = (sent + i) % 251;
+      uint16_t pushed = 0;
+      while (pushed < n) {
+        pushed += queue.push(&chunk[pushed], n - pushed);
+        if (pushed < n) std::this_thread::yield();
+      }
+      sent += n;
+    }
+  });
+  uint8_t chunk[61];
+  uint32_t received = 0;
+  uint32_t wrong = 0;
+  for (uint16_t len = 1; received < total; len = len % 61 + 1) {
+    uint16_t n = queue.pop(chunk, len);
+    if (!n) std::this_thread::yield();
+    for (uint16_t i = 0; i < n; i++) wrong += (chunk[i] != (received + i) % 251);
+    received += n;
+  }
+  producer.join();
+  CHECK_EQ(received, total);
+  CHECK_EQ(wrong, 0);
+  CHECK_EQ(queue.available(), 0);
+}
+
+//the task blocks while the bus is idle, waits for the uart tick by tick only while a meter holds it
+static void test_idle() {
+  SimBus *bus = new SimBus();
+  SimMeter &meter = bus->add_meter(0x12345678);
+  meter.set_volume(123);
+  Mbus *mbus = sim_mbus(bus, meter.address(), 60000);
+  sim_record_table(mbus, {vif_volume});
+  mbus->call_setup();
+
+  uint32_t takes = test::task_notify_takes();
+  test::advance(300000);
+  CHECK(meter.readouts >= 4);
+  CHECK_EQ(mbus->get_stats()->failed_transactions, 0);
+  CHECK_EQ(volume_of(mbus), 123);
+  //a readout takes well under a second of the minute between them
+  CHECK(test::task_notify_takes() - takes < 300000 / 20);
+  CHECK(test::task_notify_takes() - takes >= 4);
+}
+
+//retries purge what the task has received of a bad frame: no byte of it is taken for the next one
+static void test_purge() {
+  SimBus *bus = new SimBus(2400, 7);
+  SimMeter &meter = bus->add_meter(0x33333333);
+  meter.set_volume(4711);
+  meter.drop_rate = 0.01;
+  meter.corrupt_rate = 0.2;
+  Mbus *mbus = sim_mbus(bus, meter.address(), 10000);
+  sim_record_table(mbus, {vif_volume});
+  mbus->call_setup();
+
+  test::advance(300000);
+  const struct MbusStats *stats = mbus->get_stats();
+  CHECK(stats->retries > 0);
+  CHECK(meter.readouts >= 20);
+  CHECK_EQ(bus->master_errors, 0);
+  CHECK_EQ(volume_of(mbus), 4711);
+}
+
+//switching the baud rate pauses the task while the uart is reinstalled
+static void test_baud_rate() {
+  SimBus *bus = new SimBus();
+  SimMeter &meter = bus->add_meter(0x44444444);
+  meter.set_volume(815);
+  meter.max_baud_rate = 9600;
+  Mbus *mbus = sim_mbus(bus, meter.address(), 10000);
+  mbus->set_max_baud_rate(9600);
+  sim_record_table(mbus, {vif_volume});
+  mbus->call_setup();
+
+  test::advance(60000);
+  CHECK(meter.readouts >= 5);
+  CHECK_EQ(mbus->get_stats()->failed_transactions, 0);
+  CHECK_EQ(bus->master_errors, 0);
+  CHECK_EQ(volume_of(mbus), 815);
+}
+
+//the latencies learned, otherwise internal to the component
+class ProbeMbus : public Mbus {
+ public:
+  uint32_t ack_latency() const { return this->mbus_ack_latency_.srtt8 >> 3; }
+  uint32_t response_latency() const { return this->mbus_response_latency_.srtt8 >> 3; }
+};
+
+//a main loop held up while the meter answers: the latencies are learned from when the task
+//received the bytes, not from when the state machine got to them
+static void test_stall() {
+  SimBus *bus = new SimBus();
+  SimMeter &meter = bus->add_meter(0x55555555);
+  meter.set_volume(42);
+  ProbeMbus *mbus = new ProbeMbus();
+  mbus->set_uart_parent(bus);
+  mbus->set_secondary_address(meter.address());
+  mbus->set_update_interval(5000);
+  mbus->set_clock(test::now);
+  sim_record_table(mbus, {vif_volume});
+  mbus->call_setup();
+
+  test::advance(20000);
+  uint32_t ack_latency = mbus->ack_latency();
+  uint32_t response_latency = mbus->response_latency();
+  CHECK(meter.readouts >= 3);
+  CHECK(ack_latency > 0);
+  CHECK(response_latency > 0);
+
+  //held up for 300 ms right after each SELECT and REQ_UD2: every answer arrives during a stall
+  uint32_t readouts = meter.readouts;
+  uint32_t frames = bus->selects + bus->requests;
+  for (uint32_t i = 0; i < 120000; i++) {
+    test::advance(1);
+    if (bus->selects + bus->requests == frames) continue;
+    frames = bus->selects + bus->requests;
+    test::stall(300);
+  }
+  const struct MbusStats *stats = mbus->get_stats();
+  CHECK(meter.readouts - readouts >= 15);
+  CHECK_EQ(stats->failed_transactions, 0);
+  CHECK_EQ(stats->collisions, 0);
+  CHECK_EQ(bus->master_errors, 0);
+  CHECK_EQ(volume_of(mbus), 42);
+  CHECK(mbus->ack_latency() <= ack_latency + 2);
+  CHECK(mbus->response_latency() <= response_latency + 2);
+  printf("latency: ack %u -> %u ms, response %u -> %u ms\n", ack_latency, mbus->ack_latency(), response_latency,
+         mbus->response_latency());
+}
+
+int main() {
+  test::seed(1);
+  test_queue_threads();
+  test_idle();
+  test_purge();
+  test_baud_rate();
+  test_stall();
+  //the tasks never return
+  int result = TEST_RESULT();
+  fflush(stdout);
+  _exit(result);
+}
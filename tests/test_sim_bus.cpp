@@ -0,0 +1,444 @@
+/* Readouts over the simulated bus: latency, dropped bytes, bad checksums,
+ * collisions, multi-frame readouts, dead meters and bus scan, all on
+ * simulated time.
+ * */
+#include "esphome_test.h"
+#include "sim_bus.h"
+#include "test.h"
+
+#include "esphome/components/mbus/sensor/mbus_sensor.h"
+
+#include <cstring>
+#include <vector>
+
+using namespace esphome;
+using namespace esphome::mbus;
+using namespace mbus_test;
+
+static const uint64_t vif_volume = 0x13;
+static const uint64_t vif_flow_temperature = 0x5B;
+
+static uint32_t volume_of(Mbus *mbus) {
+  const struct MbusRecordSlot *slot = mbus->get_record_slot(0);
+  return (slot->match_count == 1 && slot->has_value) ? (uint32_t) slot->value.integer : 0xFFFFFFFF;
+}
+
+static void test_clean() {
+  SimBus *bus = new SimBus();
+  SimMeter &meter = bus->add_meter(0x12345678);
+  meter.set_volume(123);
+  Mbus *mbus = sim_mbus(bus, meter.address(), 10000);
+  sim_record_table(mbus, {vif_volume});
+  mbus->call_setup();
+
+  test::advance(35000);
+  const struct MbusStats *stats = mbus->get_stats();
+  CHECK(meter.readouts >= 3);
+  CHECK_EQ(stats->failed_transactions, 0);
+  CHECK_EQ(stats->retries, 0);
+  CHECK_EQ(bus->master_errors, 0);
+  CHECK_EQ(volume_of(mbus), 123);
+  //runs on the clock it was given, not on the host's
+  CHECK_EQ(mbus->get_time(), test::now());
+  CHECK(!strcmp(mbus->get_address_str(), "123456782d2c0107"));
+}
+
+static void test_latency() {
+  SimBus *bus = new SimBus();
+  SimMeter &meter = bus->add_meter(0x22222222);
+  meter.latency_ms = 150;
+  Mbus *mbus = sim_mbus(bus, meter.address(), 10000);
+  sim_record_table(mbus, {vif_volume});
+  mbus->call_setup();
+
+  test::advance(35000);
+  const struct MbusStats *stats = mbus->get_stats();
+  CHECK(meter.readouts >= 3);
+  CHECK_EQ(stats->failed_transactions, 0);
+  CHECK(stats->phases[MBUS_PHASE_HEADER].last_ms >= 150);
+}
+
+static void test_dropped_bytes() {
+  SimBus *bus = new SimBus(2400, 7);
+  SimMeter &meter = bus->add_meter(0x33333333);
+  meter.set_volume(4711);
+  meter.drop_rate = 0.01;
+  Mbus *mbus = sim_mbus(bus, meter.address(), 10000);
+  sim_record_table(mbus, {vif_volume});
+  mbus->call_setup();
+
+  test::advance(600000);
+  const struct MbusStats *stats = mbus->get_stats();
+  CHECK(stats->data_timeouts + stats->header_timeouts + stats->checksum_errors > 0);
+  CHECK(stats->retries > 0);
+  CHECK(meter.readouts >= 50);
+  //a frame with a byte missing is never taken for a valid one
+  CHECK_EQ(volume_of(mbus), 4711);
+}
+
+static void test_bad_checksums() {
+  SimBus *bus = new SimBus(2400, 11);
+  SimMeter &meter = bus->add_meter(0x44444444);
+  meter.set_volume(815);
+  meter.corrupt_rate = 0.3;
+  Mbus *mbus = sim_mbus(bus, meter.address(), 10000);
+  sim_record_table(mbus, {vif_volume});
+  mbus->call_setup();
+
+  test::advance(300000);
+  const struct MbusStats *stats = mbus->get_stats();
+  CHECK(stats->checksum_errors > 0);
+  CHECK(mbus->telegram_count > 0);
+  CHECK_EQ(volume_of(mbus), 815);
+}
+
+static void test_collisions() {
+  SimBus *bus = new SimBus();
+  SimMeter &a = bus->add_meter(0x55555551);
+  SimMeter &b = bus->add_meter(0x55555552);
+  a.primary = b.primary = 5;
+  Mbus *mbus = sim_mbus(bus, 0xFFFFFFFFFFFFFFFF, 10000);
+  mbus->set_primary_address(5);
+  sim_record_table(mbus, {vif_volume});
+  mbus->call_setup();
+
+  test::advance(60000);
+  const struct MbusStats *stats = mbus->get_stats();
+  CHECK(bus->collisions > 0);
+  CHECK(stats->invalid_headers > 0);
+  CHECK_EQ(mbus->telegram_count, 0);
+  CHECK(mbus->is_suspended());
+  //told apart from other meters read at their primary address
+  CHECK(test::log_contains("primary 5: "));
+
+  //one of them moves away: the other is read again
+  b.primary = 6;
+  test::advance(120000);
+  CHECK(!mbus->is_suspended());
+  CHECK(mbus->telegram_count > 0);
+}
+
+static void test_multi_frame() {
+  SimBus *bus = new SimBus();
+  SimMeter &meter = bus->add_meter(0x66666666);
+  meter.frames = {{0x04, 0x13, 0x10, 0x00, 0x00, 0x00}, {0x02, 0xFD, 0x17, 0x00, 0x00}, {0x02, 0x5B, 0x2A, 0x00}};
+  Mbus *mbus = sim_mbus(bus, meter.address(), 10000);
+  sim_record_table(mbus, {vif_volume, vif_flow_temperature});
+  mbus->call_setup();
+
+  test::advance(25000);
+  CHECK(meter.readouts >= 2);
+  CHECK_EQ(mbus->get_stats()->failed_transactions, 0);
+  CHECK_EQ(volume_of(mbus), 0x10);
+  const struct MbusRecordSlot *temperature = mbus->get_record_slot(1);
+  CHECK(temperature->match_count == 1 && temperature->has_value);
+  CHECK_EQ(temperature->value.integer, 42);
+}
+
+static void test_dead_meter() {
+  SimBus *bus = new SimBus();
+  SimMeter &meter = bus->add_meter(0x77777777);
+  meter.dead = true;
+  Mbus *mbus = sim_mbus(bus, meter.address(), 10000);
+  sim_record_table(mbus, {vif_volume});
+  mbus->call_setup();
+
+  test::advance(60000);
+  CHECK(mbus->is_suspended());
+  CHECK_EQ(mbus->get_stats()->suspensions, 1);
+
+  meter.dead = false;
+  test::advance(300000);
+  CHECK(!mbus->is_suspended());
+  CHECK(meter.readouts > 0);
+}
+
+static void test_scan() {
+  SimBus *bus = new SimBus();
+  uint32_t ids[] = {0x10000001, 0x10000002, 0x20000001, 0x12345678, 0x87654321};
+  for (uint32_t id : ids) bus->add_meter(id);
+  Mbus *mbus = sim_mbus(bus, 0x10000001FFFFFFFF, 60000);
+  mbus->set_scan_bus("sim_scan");
+  mbus->call_setup();
+
+  test::advance(120000);
+  const struct MbusScanResult *result = mbus->get_scan_result();
+  CHECK_EQ(result->count, 5);
+  CHECK_EQ(bus->master_errors, 0);
+
+  //after a reboot, the cached result is used: no select before the first readout
+  test::preferences().reboot();
+  SimBus *rebooted = new SimBus();
+  for (uint32_t id : ids) rebooted->add_meter(id);
+  Mbus *again = sim_mbus(rebooted, 0x10000001FFFFFFFF, 60000);
+  again->set_scan_bus("sim_scan");
+  again->call_setup();
+  CHECK_EQ(again->get_scan_result()->count, 5);
+  for (uint8_t i = 0; i < 5; i++) CHECK_EQ(again->get_scan_result()->addresses[i], result->addresses[i]);
+  test::advance(1);
+  CHECK_EQ(rebooted->selects, 0);
+}
+
+//flash preferences full, as on an ESP8266 with many sensors: scanning again at every boot, with a warning
+static void test_scan_cache_full() {
+  test::preferences().reboot();
+  test::preferences().set_budget(16);
+  test::log_clear();
+  SimBus *bus = new SimBus();
+  bus->add_meter(0x30000001);
+  bus->add_meter(0x30000002);
+  Mbus *mbus = sim_mbus(bus, 0x30000001FFFFFFFF, 60000);
+  mbus->set_scan_bus("sim_scan_full");
+  mbus->call_setup();
+  test::advance(60000);
+  CHECK_EQ(mbus->get_scan_result()->count, 2);
+  CHECK(test::log_contains("Could not save scan result"));
+  test::preferences().set_budget(0);
+}
+
+//60 meters, their result cached in pages within the flash preferences of an ESP8266, which 16 meters do not hold
+static Mbus *scanned_60(SimBus *bus, uint8_t cache_size) {
+  Mbus *mbus = sim_mbus(bus, 0x10000001FFFFFFFF, 600000);
+  mbus->set_scan_bus("sim_scan_60");
+  mbus->set_scan_cache_size(cache_size);
+  mbus->call_setup();
+  return mbus;
+}
+
+static void test_scan_cache_pages() {
+  std::vector<uint32_t> ids;
+  //BCD, as secondary addresses are
+  for (uint32_t i = 0; i < 60; i++) {
+    uint32_t n = 10000000 + i * 1234567, id = 0;
+    for (uint32_t shift = 0; shift < 32; shift += 4, n /= 10) id |= (n % 10) << shift;
+    ids.push_back(id);
+  }
+  test::preferences().reboot();
+  test::preferences().set_budget(128);
+  test::log_clear();
+  SimBus *bus = new SimBus();
+  for (uint32_t id : ids) bus->add_meter(id);
+  Mbus *small = scanned_60(bus, 16);
+  test::advance(600000);
+  CHECK_EQ(small->get_scan_result()->count, 60);
+  CHECK(test::log_contains("not cached, more than scan_cache_size 16"));
+  small->stop_poller();
+
+  test::preferences().reboot();
+  test::log_clear();
+  SimBus *sized = new SimBus();
+  for (uint32_t id : ids) sized->add_meter(id);
+  Mbus *mbus = scanned_60(sized, 60);
+  test::advance(600000);
+  const struct MbusScanResult *result = mbus->get_scan_result();
+  CHECK_EQ(result->count, 60);
+  CHECK(!test::log_contains("scanning again at next boot"));
+  //header and 4 pages
+  CHECK_EQ(test::preferences().used_words(), 6 + 4 * 21);
+  mbus->stop_poller();
+
+  test::preferences().reboot();
+  SimBus *rebooted = new SimBus();
+  for (uint32_t id : ids) rebooted->add_meter(id);
+  Mbus *again = scanned_60(rebooted, 60);
+  CHECK_EQ(again->get_scan_result()->count, 60);
+  for (uint8_t i = 0; i < 60; i++) CHECK_EQ(again->get_scan_result()->addresses[i], result->addresses[i]);
+  test::advance(1);
+  CHECK_EQ(rebooted->selects, 0);
+  again->stop_poller();
+  test::preferences().set_budget(0);
+}
+
+//a bus kept busy by higher-priority meters: a meter kept waiting keeps the deadline of its poll, and is read
+//once overdue, within the next update interval
+static void test_starvation() {
+  SimBus *bus = new SimBus();
+  std::vector<Mbus *> busy;
+  for (uint32_t i = 0; i < 9; i++) {
+    SimMeter &meter = bus->add_meter(0x80000001 + i);
+    meter.set_volume(1);
+    meter.latency_ms = 150;
+    Mbus *mbus = sim_mbus(bus, meter.address(), 9000);
+    mbus->set_priority(10);
+    sim_record_table(mbus, {vif_volume});
+    busy.push_back(mbus);
+  }
+  SimMeter &low = bus->add_meter(0x80000100);
+  low.set_volume(2);
+  Mbus *mbus = sim_mbus(bus, low.address(), 2000);
+  sim_record_table(mbus, {vif_volume});
+  for (Mbus *other : busy) other->call_setup();
+  mbus->call_setup();
+
+  test::advance(120000);
+  CHECK(low.requests >= 25);
+  //of 60 polls, at most every other one finds the meter still waiting
+  CHECK(mbus->get_stats()->missed_deadlines <= 35);
+  //overrunning their intervals, they would flood the log of the tests to come
+  for (Mbus *other : busy) other->stop_poller();
+  mbus->stop_poller();
+}
+
+//meters on a bus with the same update_interval, their pollers at random phases: read in one sweep that
+//resets the bus once, each of them with fresh data
+static void test_sweep() {
+  SimBus *bus = new SimBus();
+  std::vector<Mbus *> instances;
+  for (uint32_t i = 0; i < 4; i++) {
+    SimMeter &meter = bus->add_meter(0x90000001 + i);
+    meter.set_volume(i);
+    Mbus *mbus = sim_mbus(bus, meter.address(), 30000);
+    sim_record_table(mbus, {vif_volume});
+    instances.push_back(mbus);
+  }
+  for (Mbus *mbus : instances) mbus->call_setup();
+
+  test::advance(300000);
+  for (auto &meter : bus->meters) {
+    CHECK(meter.readouts >= 9);
+    //no request repeated the previous response
+    CHECK_EQ(meter.readouts, meter.requests);
+  }
+  //two SND_NKE per sweep
+  CHECK(bus->resets <= 2 * 11);
+}
+
+//a busy bus: the meters polled most often are read again before the sweep ends,
+//each readout of them after the first without a reset of its own
+static void test_sweep_reread() {
+  SimBus *bus = new SimBus();
+  std::vector<Mbus *> instances;
+  for (uint32_t i = 0; i < 3; i++) {
+    SimMeter &meter = bus->add_meter(0x90000011 + i);
+    meter.set_volume(i);
+    meter.latency_ms = 150;
+    Mbus *mbus = sim_mbus(bus, meter.address(), 400 + 10 * i);
+    sim_record_table(mbus, {vif_volume});
+    instances.push_back(mbus);
+  }
+  for (Mbus *mbus : instances) mbus->call_setup();
+
+  test::advance(60000);
+  uint32_t requests = 0;
+  for (auto &meter : bus->meters) {
+    CHECK(meter.readouts >= 10);
+    //no request repeated the previous response
+    CHECK_EQ(meter.readouts, meter.requests);
+    requests += meter.requests;
+  }
+  //meters read more than once per sweep
+  CHECK(bus->resets < requests);
+  //overrunning their intervals, they would flood the log of the tests to come
+  for (Mbus *mbus : instances) mbus->stop_poller();
+}
+
+//meters polled faster than the bus allows: max_bus_utilization holds readouts back, none of them starves
+static float utilization_of(float max_utilization, std::vector<uint32_t> *readouts) {
+  SimBus *bus = new SimBus();
+  std::vector<Mbus *> instances;
+  for (uint32_t i = 0; i < 3; i++) {
+    SimMeter &meter = bus->add_meter(0x90000021 + i);
+    meter.set_volume(i);
+    meter.latency_ms = 150;
+    Mbus *mbus = sim_mbus(bus, meter.address(), 1000);
+    if (max_utilization < 100.0f) mbus->set_max_bus_utilization(max_utilization);
+    sim_record_table(mbus, {vif_volume});
+    instances.push_back(mbus);
+  }
+  for (Mbus *mbus : instances) mbus->call_setup();
+
+  test::advance(300000);
+  float utilization = instances[0]->get_statistic(MBUS_STATISTIC_BUS_UTILIZATION);
+  for (auto &meter : bus->meters) readouts->push_back(meter.readouts);
+  //overrunning their intervals, they would flood the log of the tests to come
+  for (Mbus *mbus : instances) mbus->stop_poller();
+  return utilization;
+}
+
+static void test_max_utilization() {
+  std::vector<uint32_t> unbounded_readouts, readouts;
+  float unbounded = utilization_of(100.0f, &unbounded_readouts);
+  float bounded = utilization_of(25.0f, &readouts);
+  CHECK(unbounded > 50.0f);
+  //a readout beyond the bound, at most
+  CHECK(bounded <= 27.0f);
+  CHECK(bounded >= 20.0f);
+  for (uint32_t i = 0; i < readouts.size(); i++) {
+    CHECK(readouts[i] < unbounded_readouts[i]);
+    //shared alike
+    CHECK(readouts[i] >= 25);
+  }
+}
+
+static MbusSensor *restored_sensor(Mbus *mbus, const char *name) {
+  auto *sensor = new MbusSensor();
+  sensor->set_name(name);
+  sensor->set_parent(mbus);
+  sensor->set_mbus_vife(vif_volume);
+  sensor->set_record_index(0);
+  sensor->set_restore_value(true);
+  return sensor;
+}
+
+//the last value is saved from an interval, published again after a reboot, and a save that fails is warned about
+static void test_restore_value() {
+  //the failing buses of earlier tests would push the warning looked for out of the log
+  test::stop_components();
+  test::preferences().reboot();
+  SimBus *bus = new SimBus();
+  SimMeter &meter = bus->add_meter(0xA0000001);
+  meter.set_volume(321);
+  Mbus *mbus = sim_mbus(bus, meter.address(), 10000);
+  sim_record_table(mbus, {vif_volume});
+  MbusSensor *sensor = restored_sensor(mbus, "restored volume");
+  mbus->call_setup();
+  sensor->call_setup();
+  test::advance(11 * 60000);
+  CHECK_EQ(sensor->state, 0.321f);
+
+  test::preferences().reboot();
+  SimBus *rebooted = new SimBus();
+  rebooted->add_meter(0xA0000001).dead = true;
+  Mbus *again = sim_mbus(rebooted, meter.address(), 10000);
+  sim_record_table(again, {vif_volume});
+  MbusSensor *restored = restored_sensor(again, "restored volume");
+  again->call_setup();
+  restored->call_setup();
+  CHECK(restored->is_stale());
+  CHECK_EQ(restored->state, 0.321f);
+
+  //preferences full, as on an ESP8266 with many sensors restoring their value
+  test::preferences().reboot();
+  test::preferences().set_budget(2);
+  test::log_clear();
+  SimBus *full = new SimBus();
+  full->add_meter(0xA0000002).set_volume(1);
+  Mbus *unsaved = sim_mbus(full, 0xA00000022D2C0107, 10000);
+  sim_record_table(unsaved, {vif_volume});
+  MbusSensor *unsaved_sensor = restored_sensor(unsaved, "unsaved volume");
+  unsaved->call_setup();
+  unsaved_sensor->call_setup();
+  test::advance(11 * 60000);
+  CHECK(test::log_contains("Could not save value"));
+  test::preferences().set_budget(0);
+}
+
+int main() {
+  test::seed(1);
+  test_clean();
+  test_latency();
+  test_dropped_bytes();
+  test_bad_checksums();
+  test_collisions();
+  test_multi_frame();
+  test_dead_meter();
+  test_scan();
+  test_scan_cache_full();
+  test_scan_cache_pages();
+  test_starvation();
+  test_sweep();
+  test_sweep_reread();
+  test_max_utilization();
+  test_restore_value();
+  return TEST_RESULT();
+}